@@ -0,0 +1,86 @@
+/*
+ * ElfSegments.cpp
+ *
+ * Validation of ELF firmware files and extraction of the segments that have to be written to flash.
+ */
+
+#include "ElfSegments.h"
+
+ElfError CheckElfHeader(const Elf32_Header& header, uint32_t fileSize, size_t maxProgramHeadersSize) noexcept
+{
+	if (   header.ident[0] != (uint8_t)Elf32_Header::MagicVal
+		|| header.ident[1] != (uint8_t)(Elf32_Header::MagicVal >> 8)
+		|| header.ident[2] != (uint8_t)(Elf32_Header::MagicVal >> 16)
+		|| header.ident[3] != (uint8_t)(Elf32_Header::MagicVal >> 24)
+		|| header.ident[4] != Elf32_Header::Class32
+		|| header.ident[5] != Elf32_Header::DataLittleEndian
+		|| header.machine != Elf32_Header::MachineArm
+		|| header.phentsize != sizeof(Elf32_ProgramHeader)
+	   )
+	{
+		return ElfError::notElfFile;
+	}
+
+	const size_t programHeadersSize = header.phnum * sizeof(Elf32_ProgramHeader);
+	if (programHeadersSize > maxProgramHeadersSize || header.phoff > fileSize || programHeadersSize > fileSize - header.phoff)
+	{
+		return ElfError::badProgramHeaders;
+	}
+	return ElfError::none;
+}
+
+ElfError GetElfSegments(const Elf32_ProgramHeader *programHeaders, size_t numProgramHeaders, uint32_t fileSize,
+						uint32_t flashStart, uint32_t flashEnd,
+						ElfSegment *segments, size_t maxSegments, size_t& numSegments, uint32_t& errorAddress) noexcept
+{
+	numSegments = 0;
+	for (size_t i = 0; i < numProgramHeaders; ++i)
+	{
+		const Elf32_ProgramHeader& ph = programHeaders[i];
+		if (ph.type != Elf32_ProgramHeader::TypeLoad || ph.filesz == 0)
+		{
+			continue;
+		}
+
+		errorAddress = ph.paddr;
+		if (ph.paddr < flashStart || ph.paddr >= flashEnd || ph.filesz > flashEnd - ph.paddr)
+		{
+			return ElfError::segmentOutsideFlash;
+		}
+		if (ph.offset > fileSize || ph.filesz > fileSize - ph.offset)
+		{
+			return ElfError::segmentPastEndOfFile;
+		}
+		if (numSegments == maxSegments)
+		{
+			return ElfError::tooManySegments;
+		}
+
+		// Insert the segment so that the list stays sorted by flash address
+		size_t j = numSegments++;
+		while (j != 0 && segments[j - 1].flashStart > ph.paddr)
+		{
+			segments[j] = segments[j - 1];
+			--j;
+		}
+		segments[j].flashStart = ph.paddr;
+		segments[j].flashEnd = ph.paddr + ph.filesz;
+		segments[j].fileOffset = ph.offset;
+	}
+
+	if (numSegments == 0)
+	{
+		return ElfError::noLoadableSegments;
+	}
+	for (size_t i = 1; i < numSegments; ++i)
+	{
+		if (segments[i].flashStart < segments[i - 1].flashEnd)
+		{
+			errorAddress = segments[i].flashStart;
+			return ElfError::segmentsOverlap;
+		}
+	}
+	return ElfError::none;
+}
+
+// End
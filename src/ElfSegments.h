@@ -0,0 +1,81 @@
+/*
+ * ElfSegments.h
+ *
+ * Validation of ELF firmware files and extraction of the segments that have to be written to flash.
+ * This doesn't depend on the hardware or on the file system, so that it can be tested on the build host.
+ */
+
+#ifndef SRC_ELFSEGMENTS_H_
+#define SRC_ELFSEGMENTS_H_
+
+#include <cstddef>
+#include <cstdint>
+
+struct Elf32_Header
+{
+	uint8_t ident[16];
+	uint16_t type;
+	uint16_t machine;
+	uint32_t version;
+	uint32_t entry;
+	uint32_t phoff;
+	uint32_t shoff;
+	uint32_t flags;
+	uint16_t ehsize;
+	uint16_t phentsize;
+	uint16_t phnum;
+	uint16_t shentsize;
+	uint16_t shnum;
+	uint16_t shstrndx;
+
+	static constexpr uint32_t MagicVal = 0x464C457F;		// 0x7F 'E' 'L' 'F'
+	static constexpr uint8_t Class32 = 1;
+	static constexpr uint8_t DataLittleEndian = 1;
+	static constexpr uint16_t MachineArm = 40;
+};
+
+struct Elf32_ProgramHeader
+{
+	uint32_t type;
+	uint32_t offset;
+	uint32_t vaddr;
+	uint32_t paddr;			// load address, which is where initialised data lives in flash
+	uint32_t filesz;
+	uint32_t memsz;
+	uint32_t flags;
+	uint32_t align;
+
+	static constexpr uint32_t TypeLoad = 1;
+};
+
+struct ElfSegment
+{
+	uint32_t flashStart;		// first flash address of the segment
+	uint32_t flashEnd;			// flash address just past the segment
+	uint32_t fileOffset;		// where the segment data starts in the file
+};
+
+enum class ElfError : uint8_t
+{
+	none,
+	notElfFile,					// wrong magic, class, byte order, machine or program header size
+	badProgramHeaders,			// too many program headers, or they don't lie within the file
+	segmentOutsideFlash,		// a segment with file data doesn't fit in the firmware area
+	segmentPastEndOfFile,		// the data of a segment doesn't lie within the file
+	tooManySegments,
+	noLoadableSegments,
+	segmentsOverlap
+};
+
+// Check the ELF header at the start of a firmware file of the given size.
+// The program headers must fit in the file and in a buffer of maxProgramHeadersSize bytes.
+ElfError CheckElfHeader(const Elf32_Header& header, uint32_t fileSize, size_t maxProgramHeadersSize) noexcept;
+
+// Build the list of segments to write from the program headers, sorted by flash address.
+// Segments without file data (e.g. .bss) are ignored. Every other loadable segment must lie within the file and within flashStart..flashEnd.
+// On error, errorAddress is the load address of the offending segment.
+ElfError GetElfSegments(const Elf32_ProgramHeader *programHeaders, size_t numProgramHeaders, uint32_t fileSize,
+						uint32_t flashStart, uint32_t flashEnd,
+						ElfSegment *segments, size_t maxSegments, size_t& numSegments, uint32_t& errorAddress) noexcept;
+
+#endif /* SRC_ELFSEGMENTS_H_ */
@@ -0,0 +1,50 @@
+/*
+ * IapKernels.h
+ *
+ * The loops that the IAP runs over every byte of the new firmware: the CRC, the blank check, and unpacking UF2 blocks.
+ * They don't depend on the hardware, so that they can be tested and benchmarked away from the boards.
+ */
+
+#ifndef SRC_IAPKERNELS_H_
+#define SRC_IAPKERNELS_H_
+
+#include <cstddef>
+#include <cstdint>
+
+struct UF2_Block
+{
+	// 32 byte header
+	uint32_t magicStart0;
+	uint32_t magicStart1;
+	uint32_t flags;
+	uint32_t targetAddr;
+	uint32_t payloadSize;
+	uint32_t blockNo;
+	uint32_t numBlocks;
+	uint32_t fileSize;		// or familyID
+	uint8_t data[476];
+	uint32_t magicEnd;
+
+	static constexpr uint32_t MagicStart0Val = 0x0A324655;
+	static constexpr uint32_t MagicStart1Val = 0x9E5D5157;
+	static constexpr uint32_t MagicEndVal = 0x0AB16F30;
+	static constexpr uint32_t DuetPayloadSize = 256;		// Duet .uf2 files always carry 256 bytes of data per 512 byte block
+};
+
+enum class Uf2Error : uint8_t
+{
+	none,
+	badBlock,					// wrong magic numbers
+	unexpectedData				// wrong target address or payload size
+};
+
+// CRC-16 (polynomial 0xA001) of a buffer, continuing from the given CRC
+uint16_t CRC16(const char *buffer, size_t length, uint16_t crc) noexcept;
+
+// Return true if every byte of the area is 0xFF. The area must be word aligned and a whole number of words long.
+bool IsBlank(const void *area, size_t length) noexcept;
+
+// Check that a UF2 block holds the data for the given flash address, and copy its DuetPayloadSize bytes of data to dest
+Uf2Error CopyUf2Block(const UF2_Block& block, uint32_t targetAddr, char *dest) noexcept;
+
+#endif /* SRC_IAPKERNELS_H_ */
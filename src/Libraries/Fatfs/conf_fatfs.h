@@ -72,7 +72,22 @@
 /  f_truncate and useless f_getfree. */
 
 
+#ifdef IAP_MINIMAL
+#define _FS_DIRBURST    0
+#else
+#define _FS_DIRBURST    4    /* 0:Disable or 1 to 255 sectors */
+#endif
+/* When _FS_DIRBURST is not 0, directory sectors are read ahead in bursts of up
+/  to this number of sectors (never past the end of the current cluster) into a
+/  static buffer, so that looking up a file in a large directory does not cost
+/  one disk access per sector. Available in read only configuration only. */
+
+
+#ifdef IAP_MINIMAL
+#define _FS_MINIMIZE    2    /* the minimal IAP build only opens, reads and seeks */
+#else
 #define _FS_MINIMIZE    0    /* 0 to 3 */
+#endif
 /* The _FS_MINIMIZE option defines minimization level to remove some functions.
 /
 /   0: Full function.
@@ -103,7 +118,11 @@
 / Locale and Namespace Configurations
 /----------------------------------------------------------------------------*/
 
+#ifdef IAP_MINIMAL
+#define _CODE_PAGE    1      /* ASCII names only, so that no conversion tables are needed */
+#else
 #define _CODE_PAGE    850
+#endif
 /* The _CODE_PAGE specifies the OEM code page to be used on the target system.
 /  Incorrect setting of the code page can cause a file open failure.
 /
@@ -132,7 +151,7 @@
 /   857  - Turkish (OEM)
 /   862  - Hebrew (OEM)
 /   874  - Thai (OEM, Windows)
-/    1    - ASCII only (Valid for non LFN cfg.)
+/    1    - ASCII only (with LFN, names containing other characters can't be found)
 */
 
 
@@ -194,6 +213,18 @@
 /  should be added to the disk_ioctl function. */
 
 
+#ifdef IAP_MINIMAL
+#define    _FS_EXFAT    0
+#else
+#define    _FS_EXFAT    1    /* 0:Disable or 1:Enable */
+#endif
+/* To enable exFAT volume support, set _FS_EXFAT to 1. exFAT volumes are
+/  supported in read only configuration and need the LFN feature. Files that
+/  are flagged as contiguous (NoFatChain) are read without any FAT access.
+/  Entry sets with a bad checksum and files of 4 GiB or more are refused, and
+/  reads stop at the valid data length of a file. */
+
+
 
 /*---------------------------------------------------------------------------/
 / System Configurations
@@ -126,6 +126,28 @@
 #endif
 
 
+/* exFAT related */
+#if _FS_EXFAT
+#if !_FS_READONLY
+#error exFAT support is available in read only cfg only.
+#endif
+#if !_USE_LFN
+#error exFAT support requires the LFN feature.
+#endif
+#endif
+
+
+/* Directory read-ahead related */
+#if _FS_DIRBURST
+#if !_FS_READONLY
+#error Directory read-ahead is available in read only cfg only.
+#endif
+#if _FS_DIRBURST > 255
+#error Wrong _FS_DIRBURST setting
+#endif
+#endif
+
+
 /* Reentrancy related */
 #if _FS_REENTRANT
 #if _USE_LFN == 1
@@ -345,10 +367,7 @@ typedef struct {
 				0xC0,0xC1,0xC2,0xC3,0xC4,0xC5,0xC6,0xC7,0xC8,0xC9,0xCA,0xCB,0xCC,0xCD,0xCE,0xCF,0xD0,0xD1,0xD2,0xD3,0xD4,0xD5,0xD6,0xD7,0xD8,0xD9,0xDA,0xDB,0xDC,0xDD,0xDE,0xDF, \
 				0xC0,0xC1,0xC2,0xC3,0xC4,0xC5,0xC6,0xC7,0xC8,0xC9,0xCA,0xCB,0xEC,0xCD,0xCE,0xCF,0xD0,0xD1,0xF2,0xD3,0xD4,0xD5,0xD6,0xF7,0xD8,0xD9,0xDA,0xDB,0xDC,0xDD,0xFE,0x9F}
 
-#elif _CODE_PAGE == 1	/* ASCII (for only non-LFN cfg) */
-#if _USE_LFN
-#error Cannot use LFN feature without valid code page.
-#endif
+#elif _CODE_PAGE == 1	/* ASCII (with LFN, only ASCII names can be matched) */
 #define _DF1S	0
 
 #else
@@ -457,6 +476,36 @@ typedef struct {
 #define	LDIR_Type			12	/* LFN type (1) */
 #define	LDIR_Chksum			13	/* Sum of corresponding SFN entry */
 #define	LDIR_FstClusLO		26	/* Filled by zero (0) */
+
+#define	BPB_ZeroedEx		11	/* exFAT: Must be zero (53) */
+#define	BPB_VolOfsEx		64	/* exFAT: Volume offset from top of the drive [sector] (8) */
+#define	BPB_TotSecEx		72	/* exFAT: Volume size [sector] (8) */
+#define	BPB_FatOfsEx		80	/* exFAT: FAT offset from top of the volume [sector] (4) */
+#define	BPB_FatSzEx			84	/* exFAT: FAT size [sector] (4) */
+#define	BPB_DataOfsEx		88	/* exFAT: Data offset from top of the volume [sector] (4) */
+#define	BPB_NumClusEx		92	/* exFAT: Number of clusters (4) */
+#define	BPB_RootClusEx		96	/* exFAT: Root directory start cluster (4) */
+#define	BPB_FSVerEx			104	/* exFAT: File system version (2) */
+#define	BPB_BytsPerSecEx	108	/* exFAT: Log2 of sector size in unit of byte (1) */
+#define	BPB_SecPerClusEx	109	/* exFAT: Log2 of cluster size in unit of sector (1) */
+#define	BPB_NumFATsEx		110	/* exFAT: Number of FATs (1) */
+
+#define	XDIR_Type			0	/* exFAT: Type of exFAT directory entry (1) */
+#define	XDIR_NumSec			1	/* exFAT: Number of secondary entries (1) */
+#define	XDIR_SetSum			2	/* exFAT: Checksum of the entry set (2) */
+#define	XDIR_Attr			4	/* exFAT: File attribute (2) */
+#define	XDIR_ModTime		12	/* exFAT: Modified time (4) */
+#define	XDIR_GenFlags		1	/* exFAT: General secondary flags (1) */
+#define	XDIR_NumName		3	/* exFAT: Number of file name characters (1) */
+#define	XDIR_NameHash		4	/* exFAT: Hash of file name (2) */
+#define	XDIR_ValidFileSize	8	/* exFAT: Valid data length (8) */
+#define	XDIR_FstClus		20	/* exFAT: First cluster of the file data (4) */
+#define	XDIR_FileSize		24	/* exFAT: File/Directory size (8) */
+#define	XDIR_NameChars		2	/* exFAT: First of the 15 file name characters in a name entry */
+
+#define	ET_FILEDIR			0x85	/* exFAT: File and directory entry */
+#define	ET_STREAM			0xC0	/* exFAT: Stream extension entry */
+#define	ET_FILENAME			0xC1	/* exFAT: File name entry */
 #define	SZ_DIR				32		/* Size of a directory entry */
 #define	LLE					0x40	/* Last long entry flag in LDIR_Ord */
 #define	DDE					0xE5	/* Deleted directory enrty mark in DIR_Name[0] */
@@ -491,6 +540,17 @@ static
 FILESEM	Files[_FS_SHARE];	/* File lock semaphores */
 #endif
 
+#if _FS_DIRBURST
+static
+DWORD DirBurst[_FS_DIRBURST * _MAX_SS / 4];	/* Directory read-ahead buffer (word aligned for DMA) */
+static
+DWORD DirBurstSect;		/* First sector held in DirBurst[] */
+static
+UINT DirBurstCnt;		/* Number of valid sectors in DirBurst[] */
+static
+WORD DirBurstId;		/* Mount ID of the volume DirBurst[] was read from */
+#endif
+
 #if _USE_LFN == 0			/* No LFN feature */
 #define	DEF_NAMEBUF			BYTE sfn[12]
 #define INIT_BUF(dobj)		(dobj).fn = sfn
@@ -834,6 +894,49 @@ static DWORD clust2sect (	/* !=0: Sector number, 0: Failed - invalid cluster# */
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Change window to the current sector of a directory                    */
+/*-----------------------------------------------------------------------*/
+
+#if _FS_DIRBURST
+static
+FRESULT move_dir_window (
+	DIR *dj			/* Directory object whose current sector is to be loaded */
+)
+{
+	FATFS *fs = dj->fs;
+	DWORD sect = dj->sect, ofs, n;
+
+
+	if (fs->winsect == sect) return FR_OK;	/* Already in the window */
+
+	ofs = sect - DirBurstSect;
+	if (DirBurstId != fs->id || ofs >= DirBurstCnt) {	/* Not read ahead yet */
+		if (dj->clust == 0)			/* Static table: read up to the end of the table */
+			n = fs->dirbase + fs->n_rootdir / (SS(fs) / SZ_DIR) - sect;
+		else						/* Dynamic table: read up to the end of the cluster */
+			n = clust2sect(fs, dj->clust) + fs->csize - sect;
+		if (n > _FS_DIRBURST) n = _FS_DIRBURST;
+		if (n <= 1)					/* Nothing to gain, read the sector into the window */
+			return move_window(fs, sect);
+		DirBurstCnt = 0;
+		if (disk_read(fs->drv, (BYTE*)DirBurst, sect, (BYTE)n) != RES_OK)
+			return FR_DISK_ERR;
+		DirBurstSect = sect; DirBurstCnt = n; DirBurstId = fs->id;
+		ofs = 0;
+	}
+	mem_cpy(fs->win, (BYTE*)DirBurst + ofs * SS(fs), SS(fs));
+	fs->winsect = sect;
+
+	return FR_OK;
+}
+#else
+#define move_dir_window(dj)	move_window((dj)->fs, (dj)->sect)
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* FAT access - Read value of a FAT entry                                */
 /*-----------------------------------------------------------------------*/
@@ -869,6 +972,13 @@ static DWORD get_fat (	/* 0xFFFFFFFF:Disk error, 1:Internal error, Else:Cluster
 		if (move_window(fs, fs->fatbase + (clst / (SS(fs) / 4)))) break;
 		p = &fs->win[clst * 4 % SS(fs)];
 		return LD_DWORD(p) & 0x0FFFFFFF;
+
+#if _FS_EXFAT
+	case FS_EXFAT :		/* Cluster numbers are below 0x7FFFFFF7, so the end of chain mark stays above n_fatent */
+		if (move_window(fs, fs->fatbase + (clst / (SS(fs) / 4)))) break;
+		p = &fs->win[clst * 4 % SS(fs)];
+		return LD_DWORD(p) & 0x7FFFFFFF;
+#endif
 	}
 
 	return 0xFFFFFFFF;	/* An error occurred at the disk I/O layer */
@@ -1091,15 +1201,14 @@ FRESULT dir_sdi (
 	WORD idx		/* Directory index number */
 )
 {
-	DWORD clst;
-	WORD ic;
+	DWORD clst, ic;
 
 
 	dj->index = idx;
 	clst = dj->sclust;
 	if (clst == 1 || clst >= dj->fs->n_fatent)	/* Check start cluster range */
 		return FR_INT_ERR;
-	if (!clst && dj->fs->fs_type == FS_FAT32)	/* Replace cluster# 0 with root cluster# if in FAT32 */
+	if (!clst && (dj->fs->fs_type == FS_FAT32 || dj->fs->fs_type == FS_EXFAT))	/* Replace cluster# 0 with root cluster# if in FAT32/exFAT */
 		clst = dj->fs->dirbase;
 
 	if (clst == 0) {	/* Static table (root-dir in FAT12/16) */
@@ -1110,6 +1219,14 @@ FRESULT dir_sdi (
 	}
 	else {				/* Dynamic table (sub-dirs or root-dir in FAT32) */
 		ic = SS(dj->fs) / SZ_DIR * dj->fs->csize;	/* Entries per cluster */
+#if _FS_EXFAT
+		if (dj->stat & XSTAT_NOFATCHAIN) {		/* Contiguous table, no need to follow the chain */
+			if ((DWORD)idx * SZ_DIR >= dj->tsize)	/* Index is out of range */
+				return FR_INT_ERR;
+			clst += idx / ic;
+			idx %= ic;
+		}
+#endif
 		while (idx >= ic) {	/* Follow cluster chain */
 			clst = get_fat(dj->fs, clst);				/* Get next cluster */
 			if (clst == 0xFFFFFFFF) return FR_DISK_ERR;	/* Disk error */
@@ -1157,6 +1274,12 @@ FRESULT dir_next (	/* FR_OK:Succeeded, FR_NO_FILE:End of table, FR_DENIED:EOT an
 		}
 		else {					/* Dynamic table */
 			if (((i / (SS(dj->fs) / SZ_DIR)) & (dj->fs->csize - 1)) == 0) {	/* Cluster changed? */
+#if _FS_EXFAT
+				if (dj->stat & XSTAT_NOFATCHAIN) {				/* Contiguous table */
+					if ((DWORD)i * SZ_DIR >= dj->tsize) return FR_NO_FILE;	/* Report EOT when end of table */
+					clst = dj->clust + 1;
+				} else
+#endif
 				clst = get_fat(dj->fs, dj->clust);				/* Get next cluster */
 				if (clst <= 1) return FR_INT_ERR;
 				if (clst == 0xFFFFFFFF) return FR_DISK_ERR;
@@ -1236,6 +1359,7 @@ int cmp_lfn (			/* 1:Matched, 0:Not matched */
 
 
 
+#if _FS_MINIMIZE <= 1
 static
 int pick_lfn (			/* 1:Succeeded, 0:Buffer overflow */
 	WCHAR *lfnbuf,		/* Pointer to the Unicode-LFN buffer */
@@ -1266,6 +1390,7 @@ int pick_lfn (			/* 1:Succeeded, 0:Buffer overflow */
 
 	return 1;
 }
+#endif
 
 
 #if !_FS_READONLY
@@ -1369,6 +1494,137 @@ BYTE sum_sfn (
 
 
 
+/*-----------------------------------------------------------------------*/
+/* exFAT directory handling - Read/Find a file entry set                 */
+/*-----------------------------------------------------------------------*/
+#if _FS_EXFAT
+static
+WORD xname_sum (		/* Name hash as stored in the stream extension entry */
+	const WCHAR *name	/* File name in Unicode */
+)
+{
+	WCHAR chr;
+	WORD sum = 0;
+
+
+	while ((chr = *name++) != 0) {
+		chr = ff_wtoupper(chr);
+		sum = (WORD)(((sum & 1) ? 0x8000 : 0) + (sum >> 1) + (chr & 0xFF));
+		sum = (WORD)(((sum & 1) ? 0x8000 : 0) + (sum >> 1) + (chr >> 8));
+	}
+	return sum;
+}
+
+
+static
+WORD xdir_sum (			/* Entry set checksum as stored in the file entry */
+	const BYTE *dir,	/* Pointer to an entry of the set */
+	WORD sum,			/* Checksum of the entries before it in the set */
+	int first			/* 1:The file entry, which leaves out its own checksum field */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < SZ_DIR; i++) {
+		if (first && (i == XDIR_SetSum || i == XDIR_SetSum + 1)) continue;
+		sum = (WORD)(((sum & 1) ? 0x8000 : 0) + (sum >> 1) + dir[i]);
+	}
+	return sum;
+}
+
+
+static
+FRESULT dir_read_ex (	/* FR_OK:Succeeded, FR_NO_FILE:End of table, FR_DENIED:4 GiB or larger, FR_INT_ERR:Broken entry set, FR_DISK_ERR:Disk error */
+	DIR *dj,			/* Pointer to the directory object */
+	int find			/* 0:Read the next object and its name into lfn[], 1:Find the object named in lfn[] */
+)
+{
+	FRESULT res, xres = FR_OK;
+	BYTE c, *dir, nsec = 0;
+	UINT i, ni = 0, nc = 0, nlen = 0;
+	WORD hash = 0, sum = 0, setsum = 0;
+	WCHAR wc;
+
+
+	if (find) {							/* Get hash and length of the name to be found */
+		hash = xname_sum(dj->lfn);
+		while (dj->lfn[nlen]) nlen++;
+	}
+
+	res = FR_NO_FILE;
+	while (dj->sect) {
+		res = move_dir_window(dj);
+		if (res != FR_OK) break;
+		dir = dj->dir;					/* Ptr to the directory entry of current index */
+		c = dir[XDIR_Type];
+		if (c == 0) { res = FR_NO_FILE; break; }	/* Reached to end of table */
+		if (c == ET_FILEDIR) {			/* Start of a file entry set */
+			nsec = dir[XDIR_NumSec];
+			if (nsec < 2) nsec = 0;		/* (At least a stream extension and a name entry) */
+			nc = 0;
+			setsum = LD_WORD(dir+XDIR_SetSum);
+			sum = xdir_sum(dir, 0, 1);
+			dj->xattr = dir[XDIR_Attr] & AM_MASK;
+			dj->xtime = LD_DWORD(dir+XDIR_ModTime);
+			dj->lfn_idx = dj->index;
+		} else if (c == ET_STREAM && nsec && !nc) {	/* Stream extension entry */
+			nsec--;
+			nc = dir[XDIR_NumName];
+			if (!nc || (find && (nc != nlen || LD_WORD(dir+XDIR_NameHash) != hash))) {
+				nsec = 0;				/* Not the one, skip the name entries without reading them */
+			} else {
+				sum = xdir_sum(dir, sum, 0);
+				dj->xstat = dir[XDIR_GenFlags] & XSTAT_NOFATCHAIN;
+				dj->xsclust = (dir[XDIR_GenFlags] & 1) ? LD_DWORD(dir+XDIR_FstClus) : 0;
+				dj->xsize = LD_DWORD(dir+XDIR_ValidFileSize);	/* The data past the valid data length is undefined */
+				if (LD_DWORD(dir+XDIR_FileSize+4))
+					xres = FR_DENIED;	/* The size does not fit in a DWORD */
+				else if (LD_DWORD(dir+XDIR_ValidFileSize+4) || dj->xsize > LD_DWORD(dir+XDIR_FileSize))
+					xres = FR_INT_ERR;	/* Valid data length past the data length */
+				else
+					xres = FR_OK;
+				ni = 0;
+			}
+		} else if ((c & 0xC0) == 0xC0 && nsec && nc) {	/* File name entry, or another secondary entry of the set */
+			nsec--;
+			sum = xdir_sum(dir, sum, 0);
+			if (c == ET_FILENAME) {
+				for (i = 0; i < 15 && ni < nc; i++, ni++) {
+					wc = LD_WORD(dir+XDIR_NameChars+i*2);
+					if (find) {
+						if (ff_wtoupper(wc) != ff_wtoupper(dj->lfn[ni])) {	/* Compare it */
+							nsec = 0; break;
+						}
+					} else {
+						if (ni < _MAX_LFN) dj->lfn[ni] = wc;
+					}
+				}
+			}
+			if (!nsec && ni == nc) {	/* End of the set, the whole name has been read or matched */
+				if (sum != setsum) xres = FR_INT_ERR;	/* Broken entry set */
+				if (xres != FR_DENIED || find) {		/* (A listing leaves out the objects that cannot be opened) */
+					if (xres == FR_OK && !find) dj->lfn[(nc < _MAX_LFN) ? nc : _MAX_LFN] = 0;
+					res = xres;
+					break;
+				}
+			}
+		} else {						/* Any other entry breaks the entry set */
+			nsec = 0;
+		}
+		res = dir_next(dj, 0);			/* Next entry */
+		if (res != FR_OK) break;
+	}
+
+	if (res != FR_OK && !find) dj->sect = 0;
+
+	return res;
+}
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Directory handling - Find an object in the directory                  */
 /*-----------------------------------------------------------------------*/
@@ -1387,11 +1643,15 @@ FRESULT dir_find (
 	res = dir_sdi(dj, 0);			/* Rewind directory object */
 	if (res != FR_OK) return res;
 
+#if _FS_EXFAT
+	if (dj->fs->fs_type == FS_EXFAT)	/* exFAT has no SFN, find the entry set by its name */
+		return dir_read_ex(dj, 1);
+#endif
 #if _USE_LFN
 	ord = sum = 0xFF;
 #endif
 	do {
-		res = move_window(dj->fs, dj->sect);
+		res = move_dir_window(dj);
 		if (res != FR_OK) break;
 		dir = dj->dir;					/* Ptr to the directory entry of current index */
 		c = dir[DIR_Name];
@@ -1447,7 +1707,7 @@ FRESULT dir_read (
 
 	res = FR_NO_FILE;
 	while (dj->sect) {
-		res = move_window(dj->fs, dj->sect);
+		res = move_dir_window(dj);
 		if (res != FR_OK) break;
 		dir = dj->dir;					/* Ptr to the directory entry of current index */
 		c = dir[DIR_Name];
@@ -1869,6 +2129,27 @@ void get_fileinfo (		/* No return code */
 
 
 	p = fno->fname;
+#if _FS_EXFAT
+	if (dj->fs->fs_type == FS_EXFAT) {	/* exFAT: no SFN, the object was captured by dir_read_ex() */
+		if (dj->sect) {
+			WCHAR w;
+			for (i = 0; (w = dj->lfn[i]) != 0; i++) {	/* Use the name as SFN if it fits */
+#if !_LFN_UNICODE
+				w = ff_convert(w, 0);
+				if (w >= 0x100) w = 0;
+#endif
+				if (i >= 12 || !w) {
+					p = fno->fname; *p++ = '?'; break;
+				}
+				*p++ = (TCHAR)w;
+			}
+			fno->fattrib = dj->xattr;				/* Attribute */
+			fno->fsize = dj->xsize;					/* Size */
+			fno->fdate = (WORD)(dj->xtime >> 16);	/* Date */
+			fno->ftime = (WORD)dj->xtime;			/* Time */
+		}
+	} else
+#endif
 	if (dj->sect) {
 		dir = dj->dir;
 		nt = dir[DIR_NTres];		/* NT flag */
@@ -1962,6 +2243,9 @@ FRESULT follow_path (	/* FR_OK(0): successful, !=0: error code */
 		path++;
 	dj->sclust = 0;						/* Start from the root dir */
 #endif
+#if _FS_EXFAT
+	dj->stat = 0;						/* (Root dir always has a FAT chain) */
+#endif
 
 	if ((UINT)*path < ' ') {			/* Nul path means the start directory itself */
 		res = dir_sdi(dj, 0);
@@ -1986,6 +2270,17 @@ FRESULT follow_path (	/* FR_OK(0): successful, !=0: error code */
 				break;
 			}
 			if (ns & NS_LAST) break;			/* Last segment match. Function completed. */
+#if _FS_EXFAT
+			if (dj->fs->fs_type == FS_EXFAT) {	/* There is next segment. Follow the sub directory */
+				if (!(dj->xattr & AM_DIR) || !dj->xsclust) {	/* Cannot follow because it is a file */
+					res = FR_NO_PATH; break;
+				}
+				dj->sclust = dj->xsclust;
+				dj->stat = dj->xstat;
+				dj->tsize = dj->xsize;
+				continue;
+			}
+#endif
 			dir = dj->dir;						/* There is next segment. Follow the sub directory */
 			if (!(dir[DIR_Attr] & AM_DIR)) {	/* Cannot follow because it is a file */
 				res = FR_NO_PATH; break;
@@ -2015,6 +2310,11 @@ BYTE check_fs (	/* 0:FAT-VBR, 1:Valid BR but not FAT, 2:Not a BR, 3:Disk error *
 	if (LD_WORD(&fs->win[BS_55AA]) != 0xAA55)		/* Check record signature (always placed at offset 510 even if the sector size is >512) */
 		return 2;
 
+#if _FS_EXFAT
+	if (!mem_cmp(&fs->win[BS_OEMName], "EXFAT   ", 8))	/* Check exFAT file system name */
+		return 0;
+#endif
+
 	if ((LD_DWORD(&fs->win[BS_FilSysType]) & 0xFFFFFF) == 0x544146)	/* Check "FAT" string */
 		return 0;
 	if ((LD_DWORD(&fs->win[BS_FilSysType32]) & 0xFFFFFF) == 0x544146)
@@ -2104,6 +2404,45 @@ FRESULT chk_mounted (	/* FR_OK(0): successful, !=0: any error occurred */
 	if (fmt == 3) return FR_DISK_ERR;
 	if (fmt) return FR_NO_FILESYSTEM;		/* No FAT volume is found */
 
+#if _FS_EXFAT
+	if (!mem_cmp(fs->win+BS_OEMName, "EXFAT   ", 8)) {	/* An exFAT volume is found */
+		for (b = 0; b < 53 && !fs->win[BPB_ZeroedEx + b]; b++) ;	/* (FAT BPB area must be zero) */
+		if (b < 53) return FR_NO_FILESYSTEM;
+		if (LD_WORD(fs->win+BPB_FSVerEx) != 0x100) return FR_NO_FILESYSTEM;	/* (Supports only revision 1.00) */
+		b = fs->win[BPB_BytsPerSecEx];
+		if (b > 12 || (1U << b) != SS(fs))				/* (Sector size must be equal to the physical sector size) */
+			return FR_NO_FILESYSTEM;
+		if (LD_DWORD(fs->win+BPB_TotSecEx+4) || LD_DWORD(fs->win+BPB_TotSecEx) > 0xFFFFFFFF - bsect)
+			return FR_NO_FILESYSTEM;					/* (Volume must be in reach of 32-bit LBA) */
+		fs->n_fats = fs->win[BPB_NumFATsEx];
+		if (fs->n_fats != 1) return FR_NO_FILESYSTEM;	/* (TexFAT volumes are not supported) */
+		b = fs->win[BPB_SecPerClusEx];
+		if (b > 15) return FR_NO_FILESYSTEM;			/* (Cluster size must fit in csize) */
+		fs->csize = (WORD)(1U << b);
+		nclst = LD_DWORD(fs->win+BPB_NumClusEx);		/* Number of clusters */
+		if (!nclst || nclst > 0x7FFFFFFD) return FR_NO_FILESYSTEM;
+		fs->n_fatent = nclst + 2;
+		fs->fsize = LD_DWORD(fs->win+BPB_FatSzEx);		/* Sectors per FAT */
+		if (fs->fsize < (fs->n_fatent + (SS(fs) / 4 - 1)) / (SS(fs) / 4))	/* (FAT size must not be less than required) */
+			return FR_NO_FILESYSTEM;
+		fs->fatbase = bsect + LD_DWORD(fs->win+BPB_FatOfsEx);	/* FAT start sector */
+		fs->database = bsect + LD_DWORD(fs->win+BPB_DataOfsEx);	/* Data start sector */
+		fs->dirbase = LD_DWORD(fs->win+BPB_RootClusEx);	/* Root directory start cluster */
+		if (fs->dirbase < 2 || fs->dirbase >= fs->n_fatent) return FR_NO_FILESYSTEM;
+		fs->n_rootdir = 0;
+
+		fs->fs_type = FS_EXFAT;	/* FAT sub-type */
+		fs->id = ++Fsid;		/* File system mount ID */
+		fs->winsect = 0;		/* Invalidate sector cache */
+		fs->wflag = 0;
+#if _FS_RPATH
+		fs->cdir = 0;			/* Current directory (root dir) */
+#endif
+		return FR_OK;
+	}
+#endif
+
+
 	/* An FAT volume is found. Following code initializes the file system object */
 
 	if (LD_WORD(fs->win+BPB_BytsPerSec) != SS(fs))		/* (BPB_BytsPerSec must be equal to the physical sector size) */
@@ -2367,6 +2706,12 @@ FRESULT f_open (
 		if (!dir) {						/* Current dir itself */
 			res = FR_INVALID_NAME;
 		} else {
+#if _FS_EXFAT
+			if (dj.fs->fs_type == FS_EXFAT) {
+				if (dj.xattr & AM_DIR)	/* It is a directory */
+					res = FR_NO_FILE;
+			} else
+#endif
 			if (dir[DIR_Attr] & AM_DIR)	/* It is a directory */
 				res = FR_NO_FILE;
 		}
@@ -2376,8 +2721,20 @@ FRESULT f_open (
 
 	if (res == FR_OK) {
 		fp->flag = mode;					/* File access mode */
+#if _FS_EXFAT
+		if (dj.fs->fs_type == FS_EXFAT) {	/* The object was captured by dir_find() */
+			fp->stat = dj.xstat;			/* Contiguous or FAT chained */
+			fp->sclust = dj.xsclust;		/* File start cluster */
+			fp->fsize = dj.xsize;			/* File size */
+		} else {
+			fp->stat = 0;
+			fp->sclust = LD_CLUST(dir);			/* File start cluster */
+			fp->fsize = LD_DWORD(dir+DIR_FileSize);	/* File size */
+		}
+#else
 		fp->sclust = LD_CLUST(dir);			/* File start cluster */
 		fp->fsize = LD_DWORD(dir+DIR_FileSize);	/* File size */
+#endif
 		fp->fptr = 0;						/* File pointer */
 		fp->dsect = 0;
 #if _USE_FASTSEEK
@@ -2405,8 +2762,8 @@ FRESULT f_read (
 {
 	FRESULT res;
 	DWORD clst, sect, remain;
-	UINT rcnt, cc;
-	BYTE csect, *rbuff = buff;
+	UINT rcnt, cc, csect, ncs;
+	BYTE *rbuff = buff;
 
 	*br = 0;	/* Initialize byte counter */
 
@@ -2422,29 +2779,43 @@ FRESULT f_read (
 	for ( ;  btr;								/* Repeat until all data read */
 		rbuff += rcnt, fp->fptr += rcnt, *br += rcnt, btr -= rcnt) {
 		if ((fp->fptr % SS(fp->fs)) == 0) {		/* On the sector boundary? */
-			csect = (BYTE)(fp->fptr / SS(fp->fs) & (fp->fs->csize - 1));	/* Sector offset in the cluster */
-			if (csect == 0) {					/* On the cluster boundary? */
-				if (fp->fptr == 0) {			/* On the top of the file? */
-					clst = fp->sclust;			/* Follow from the origin */
-				} else {						/* Middle or end of the file */
+			csect = (UINT)(fp->fptr / SS(fp->fs) & (fp->fs->csize - 1));	/* Sector offset in the cluster */
+			ncs = fp->fs->csize - csect;		/* Number of sectors up to the cluster boundary */
+#if _FS_EXFAT
+			if (fp->stat & XSTAT_NOFATCHAIN) {	/* Contiguous file: locate the sector without any FAT access */
+				sect = clust2sect(fp->fs, fp->sclust);
+				if (!sect) ABORT(fp->fs, FR_INT_ERR);
+				sect += fp->fptr / SS(fp->fs);
+				fp->clust = fp->sclust + fp->fptr / SS(fp->fs) / fp->fs->csize;
+				ncs = 255;						/* No cluster boundary to clip the transfer at */
+			} else
+#endif
+			{
+				if (csect == 0) {					/* On the cluster boundary? */
+					if (fp->fptr == 0) {			/* On the top of the file? */
+						clst = fp->sclust;			/* Follow from the origin */
+					} else {						/* Middle or end of the file */
 #if _USE_FASTSEEK
-					if (fp->cltbl)
-						clst = clmt_clust(fp, fp->fptr);	/* Get cluster# from the CLMT */
-					else
+						if (fp->cltbl)
+							clst = clmt_clust(fp, fp->fptr);	/* Get cluster# from the CLMT */
+						else
 #endif
-						clst = get_fat(fp->fs, fp->clust);	/* Follow cluster chain on the FAT */
+							clst = get_fat(fp->fs, fp->clust);	/* Follow cluster chain on the FAT */
+					}
+					if (clst < 2) ABORT(fp->fs, FR_INT_ERR);
+					if (clst == 0xFFFFFFFF) ABORT(fp->fs, FR_DISK_ERR);
+					fp->clust = clst;				/* Update current cluster */
 				}
-				if (clst < 2) ABORT(fp->fs, FR_INT_ERR);
-				if (clst == 0xFFFFFFFF) ABORT(fp->fs, FR_DISK_ERR);
-				fp->clust = clst;				/* Update current cluster */
+				sect = clust2sect(fp->fs, fp->clust);	/* Get current sector */
+				if (!sect) ABORT(fp->fs, FR_INT_ERR);
+				sect += csect;
 			}
-			sect = clust2sect(fp->fs, fp->clust);	/* Get current sector */
-			if (!sect) ABORT(fp->fs, FR_INT_ERR);
-			sect += csect;
 			cc = btr / SS(fp->fs);				/* When remaining bytes >= sector size, */
 			if (cc != 0 && isAligned(rbuff)) {	/* Read maximum contiguous sectors directly */
-				if (csect + cc > fp->fs->csize)	/* Clip at cluster boundary */
-					cc = fp->fs->csize - csect;
+				if (cc > ncs)					/* Clip at cluster boundary */
+					cc = ncs;
+				if (cc > 255)					/* (disk_read() transfers 255 sectors at most) */
+					cc = 255;
 				if (disk_read(fp->fs->drv, rbuff, sect, (BYTE)cc) != RES_OK)
 					ABORT(fp->fs, FR_DISK_ERR);
 #if !_FS_READONLY && _FS_MINIMIZE <= 2			/* Replace one of the read sectors with cached data if it contains a dirty sector */
@@ -2912,6 +3283,9 @@ FRESULT f_lseek (
 		if (ofs) {
 			bcs = (DWORD)fp->fs->csize * SS(fp->fs);	/* Cluster size (byte) */
 			if (ifptr > 0 &&
+#if _FS_EXFAT
+				!(fp->stat & XSTAT_NOFATCHAIN) &&		/* (fp->clust is not tracked in a contiguous file) */
+#endif
 				(ofs - 1) / bcs >= (ifptr - 1) / bcs) {	/* When seek to same or following cluster, */
 				fp->fptr = (ifptr - 1) & ~(bcs - 1);	/* start from the current cluster */
 				ofs -= fp->fptr;
@@ -2937,6 +3311,11 @@ FRESULT f_lseek (
 							ofs = bcs; break;
 						}
 					} else
+#endif
+#if _FS_EXFAT
+					if (fp->stat & XSTAT_NOFATCHAIN)	/* Contiguous file, the next cluster follows */
+						clst++;
+					else
 #endif
 						clst = get_fat(fp->fs, clst);	/* Follow cluster chain if not in write mode */
 					if (clst == 0xFFFFFFFF) ABORT(fp->fs, FR_DISK_ERR);
@@ -3001,6 +3380,17 @@ FRESULT f_opendir (
 		FREE_BUF();
 		if (res == FR_OK) {						/* Follow completed */
 			if (dj->dir) {						/* It is not the root dir */
+#if _FS_EXFAT
+				if (dj->fs->fs_type == FS_EXFAT) {
+					if ((dj->xattr & AM_DIR) && dj->xsclust) {	/* The object is a directory */
+						dj->sclust = dj->xsclust;
+						dj->stat = dj->xstat;
+						dj->tsize = dj->xsize;
+					} else {					/* The object is not a directory */
+						res = FR_NO_PATH;
+					}
+				} else
+#endif
 				if (dj->dir[DIR_Attr] & AM_DIR) {	/* The object is a directory */
 					dj->sclust = LD_CLUST(dj->dir);
 				} else {						/* The object is not a directory */
@@ -3039,6 +3429,11 @@ FRESULT f_readdir (
 			res = dir_sdi(dj, 0);			/* Rewind the directory object */
 		} else {
 			INIT_BUF(*dj);
+#if _FS_EXFAT
+			if (dj->fs->fs_type == FS_EXFAT)
+				res = dir_read_ex(dj, 0);	/* Read an exFAT file entry set */
+			else
+#endif
 			res = dir_read(dj);				/* Read an directory item */
 			if (res == FR_NO_FILE) {		/* Reached end of dir */
 				dj->sect = 0;
@@ -79,11 +79,11 @@ typedef char TCHAR;
 typedef struct {
 	BYTE	fs_type;		/* FAT sub-type (0:Not mounted) */
 	BYTE	drv;			/* Physical drive number */
-	BYTE	csize;			/* Sectors per cluster (1,2,4...128) */
 	BYTE	n_fats;			/* Number of FAT copies (1,2) */
 	BYTE	wflag;			/* win[] dirty flag (1:must be written back) */
 	BYTE	fsi_flag;		/* fsinfo dirty flag (1:must be written back) */
 	WORD	id;				/* File system mount ID */
+	WORD	csize;			/* Sectors per cluster (1,2,4...128, up to 32768 on exFAT) */
 	WORD	n_rootdir;		/* Number of root directory entries (FAT12/16) */
 #if _MAX_SS != 512
 	WORD	ssize;			/* Bytes per sector (512, 1024, 2048 or 4096) */
@@ -102,7 +102,7 @@ typedef struct {
 	DWORD	n_fatent;		/* Number of FAT entries (= number of clusters + 2) */
 	DWORD	fsize;			/* Sectors per FAT */
 	DWORD	fatbase;		/* FAT start sector */
-	DWORD	dirbase;		/* Root directory start sector (FAT32:Cluster#) */
+	DWORD	dirbase;		/* Root directory start sector (FAT32/exFAT:Cluster#) */
 	DWORD	database;		/* Data start sector */
 	DWORD	winsect;		/* Current sector appearing in the win[] */
 	BYTE	win[_MAX_SS];	/* Disk access window for Directory, FAT (and Data on tiny cfg) */
@@ -116,7 +116,11 @@ typedef struct {
 	FATFS*	fs;				/* Pointer to the owner file system object */
 	WORD	id;				/* Owner file system mount ID */
 	BYTE	flag;			/* File status flags */
+#if _FS_EXFAT
+	BYTE	stat;			/* Cluster chain status (exFAT: XSTAT_NOFATCHAIN when the file is contiguous) */
+#else
 	BYTE	pad1;
+#endif
 	DWORD	fptr;			/* File read/write pointer (0 on file open) */
 	DWORD	fsize;			/* File size */
 	DWORD	sclust;			/* File start cluster (0 when fsize==0) */
@@ -154,6 +158,15 @@ typedef struct {
 	WCHAR*	lfn;			/* Pointer to the LFN working buffer */
 	WORD	lfn_idx;		/* Last matched LFN index number (0xFFFF:No LFN) */
 #endif
+#if _FS_EXFAT
+	BYTE	stat;			/* Table chain status (XSTAT_NOFATCHAIN when the table is contiguous) */
+	DWORD	tsize;			/* Table size in bytes (contiguous table only) */
+	BYTE	xattr;			/* Attribute of the found object (exFAT) */
+	BYTE	xstat;			/* Chain status of the found object (exFAT) */
+	DWORD	xsclust;		/* Start cluster of the found object (exFAT) */
+	DWORD	xsize;			/* Valid data length of the found object (exFAT) */
+	DWORD	xtime;			/* Last modified time stamp of the found object (exFAT) */
+#endif
 } DIR;
 
 
@@ -298,6 +311,12 @@ int ff_del_syncobj (_SYNC_t);		/* Delete a sync object */
 #define FS_FAT12	1
 #define FS_FAT16	2
 #define FS_FAT32	3
+#define FS_EXFAT	4
+
+
+/* Cluster chain status (FIL.stat, DIR.stat) */
+
+#define XSTAT_NOFATCHAIN	0x02	/* Object is contiguous, the FAT is not used for it (exFAT) */
 
 
 /* File attribute bits for directory entry */
@@ -150,6 +150,14 @@
 /  should be added to the disk_ioctl function. */
 
 
+#define	_FS_EXFAT	0	/* 0:Disable or 1:Enable */
+/* To enable exFAT volume support, set _FS_EXFAT to 1. exFAT volumes are
+/  supported in read only configuration and need the LFN feature. Files that
+/  are flagged as contiguous (NoFatChain) are read without any FAT access.
+/  Entry sets with a bad checksum and files of 4 GiB or more are refused, and
+/  reads stop at the valid data length of a file. */
+
+
 
 /*---------------------------------------------------------------------------/
 / System Configurations
@@ -56,6 +56,15 @@
 // Define this to enable the debug trace to the current standard output (stdio)
 //#define SD_MMC_DEBUG
 
+// Define this to enable command queueing on SD cards that support it, i.e. A2 class cards, when they are initialised.
+// It is only done on the Multimedia Card interface. Reads use CMD17/CMD18 either way.
+#ifndef IAP_MINIMAL
+# define SD_MMC_CMD_QUEUE_ENABLE
+#endif
+
+// Maximum number of read tasks to keep queued on the card, however deep its queue is
+#define SD_MMC_CMD_QUEUE_MAX_DEPTH	8
+
 /*! \name board MCI SD/MMC slot template definition
  *
  * The GPIO and MCI/HSMCI connections of the SD/MMC Connector must be added
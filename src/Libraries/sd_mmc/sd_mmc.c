@@ -215,6 +215,7 @@ struct sd_mmc_card {
 	uint8_t bus_width;			//!< Number of DATA lines on bus (MCI only)
 	uint8_t csd[CSD_REG_BSIZE];	//!< CSD register
 	uint8_t high_speed;			//!< High speed card (1)
+	uint8_t cmdq_depth;			// Number of read tasks we may queue on the card, or 0 if command queueing is not in use
 };
 
 //! SD/MMC card list
@@ -270,6 +271,12 @@ static bool sdio_cmd53(uint8_t rw_flag, uint8_t func_nb, uint32_t reg_addr,
 #endif // SDIO_SUPPORT_ENABLE
 static bool sd_acmd6(void);
 static bool sd_acmd51(void);
+#ifdef SD_MMC_CMD_QUEUE_ENABLE
+static bool sd_acmd13(uint8_t *status);
+static bool sd_cmd48(uint8_t fno, uint8_t page, uint16_t offset, uint16_t len, uint8_t *buf);
+static bool sd_cmd49(uint8_t fno, uint8_t page, uint16_t offset, uint8_t value, uint8_t *buf);
+static void sd_enable_cmd_queue(void);
+#endif
 //! @}
 
 //! \name Internal function to process the initialization and install
@@ -277,6 +284,7 @@ static bool sd_acmd51(void);
 static sd_mmc_err_t sd_mmc_select_slot(uint8_t slot);
 static void sd_mmc_configure_slot(void);
 static void sd_mmc_deselect_slot(void);
+static void sd_mmc_abort_read_blocks(void);
 static bool sd_mmc_spi_card_init(void);
 static bool sd_mmc_mci_card_init(void);
 static bool sd_mmc_spi_install_mmc(void);
@@ -1248,6 +1256,153 @@ static bool sd_acmd51(void)
 	return true;
 }
 
+#ifdef SD_MMC_CMD_QUEUE_ENABLE
+
+/**
+ * \brief ACMD13 - Read the SD Status register.
+ *
+ * \param status  Buffer of SD_STATUS_BSIZE bytes to receive the register
+ *
+ * \return true if success, otherwise false
+ */
+static bool sd_acmd13(uint8_t *status)
+{
+	// CMD55 - Indicate to the card that the next command is an
+	// application specific command rather than a standard command.
+	if (!sd_mmc_card->iface->send_cmd(SDMMC_CMD55_APP_CMD, (uint32_t)sd_mmc_card->rca << 16)) {
+		return false;
+	}
+	if (!sd_mmc_card->iface->adtc_start(SD_ACMD13_SD_STATUS, 0, SD_STATUS_BSIZE, 1, status)) {
+		return false;
+	}
+	if (!sd_mmc_card->iface->start_read_blocks(status, 1)) {
+		return false;
+	}
+	return sd_mmc_card->iface->wait_end_of_read_blocks();
+}
+
+/**
+ * \brief CMD48 - Read from the memory extension register space.
+ *
+ * \param fno     Function number
+ * \param page    Page number
+ * \param offset  Offset of the first register within the page
+ * \param len     Number of bytes wanted
+ * \param buf     Word aligned buffer of SD_EXTR_BSIZE bytes. The register at offset is returned in buf[0].
+ *
+ * \return true if success, otherwise false
+ */
+static bool sd_cmd48(uint8_t fno, uint8_t page, uint16_t offset, uint16_t len, uint8_t *buf)
+{
+	if (!sd_mmc_card->iface->adtc_start(SD_CMD48_READ_EXTR_SINGLE,
+			SD_EXTR_FNO(fno) | SD_EXTR_ADDR(page, offset) | SD_EXTR_LEN(len), SD_EXTR_BSIZE, 1, buf)) {
+		return false;
+	}
+	if (sd_mmc_card->iface->get_response() & CARD_STATUS_ERR_RD_WR) {
+		return false;
+	}
+	if (!sd_mmc_card->iface->start_read_blocks(buf, 1)) {
+		return false;
+	}
+	return sd_mmc_card->iface->wait_end_of_read_blocks();
+}
+
+/**
+ * \brief CMD49 - Write one register in the memory extension register space.
+ *
+ * \param fno     Function number
+ * \param page    Page number
+ * \param offset  Offset of the register within the page
+ * \param value   Value to write
+ * \param buf     Word aligned buffer of SD_EXTR_BSIZE bytes used to send the data block
+ *
+ * \return true if success, otherwise false
+ */
+static bool sd_cmd49(uint8_t fno, uint8_t page, uint16_t offset, uint8_t value, uint8_t *buf)
+{
+	memset(buf, 0, SD_EXTR_BSIZE);
+	buf[0] = value;
+	if (!sd_mmc_card->iface->adtc_start(SD_CMD49_WRITE_EXTR_SINGLE,
+			SD_EXTR_FNO(fno) | SD_EXTR_ADDR(page, offset) | SD_EXTR_LEN(1), SD_EXTR_BSIZE, 1, buf)) {
+		return false;
+	}
+	if (sd_mmc_card->iface->get_response() & CARD_STATUS_ERR_RD_WR) {
+		return false;
+	}
+	if (!sd_mmc_card->iface->start_write_blocks(buf, 1)) {
+		return false;
+	}
+	if (!sd_mmc_card->iface->wait_end_of_write_blocks()) {
+		return false;
+	}
+	// The card is busy until the new setting has taken effect
+	return sd_mmc_cmd13();
+}
+
+/**
+ * \brief Enable command queueing if the card supports it.
+ *
+ * Support and queue depth are read from the SD Status register. Command queueing
+ * is then enabled in the performance enhancement register set, which is located
+ * through the general information page of the extension register space.
+ * If anything fails, command queueing is left disabled.
+ *
+ * Reads still use CMD17/CMD18, which the card accepts while no tasks are queued.
+ * This driver does not queue tasks (CMD44/CMD45) or execute them (CMD46).
+ * A driver that does must not let the interface follow CMD46 with a CMD12.
+ * The SAME5x SDHC can send one automatically after multiple block commands
+ * (Auto CMD12 in its transfer mode register), but a task stops by itself after
+ * the block count given in CMD44, so there is no transfer left to stop.
+ */
+static void sd_enable_cmd_queue(void)
+{
+	uint32_t buf32[SD_EXTR_BSIZE / sizeof(uint32_t)];		// word aligned for DMA
+	uint8_t * const buf = (uint8_t *)buf32;
+
+	// Queued tasks are addressed in blocks, and A2 cards are always SDHC or SDXC anyway
+	if (!(sd_mmc_card->type & CARD_TYPE_HC) || !sd_acmd13(buf)) {
+		return;
+	}
+	const uint32_t perfClass = SD_STATUS_APP_PERF_CLASS(buf);
+	const uint32_t cmdqSupport = SD_STATUS_CMDQ_SUPPORT(buf);
+	sd_mmc_debug("Performance class A%u, command queue support %u\n\r", (unsigned int)perfClass, (unsigned int)cmdqSupport);
+	if (perfClass < SD_STATUS_APP_PERF_CLASS_A2 || cmdqSupport == 0) {
+		return;
+	}
+
+	// Find the performance enhancement register set
+	if (!sd_cmd48(0, 0, 0, SD_EXTR_BSIZE, buf)
+		|| SD_EXTR_GEN_REVISION(buf) != 0 || SD_EXTR_GEN_LENGTH(buf) > SD_EXTR_BSIZE) {
+		return;
+	}
+	uint32_t regAddr = 0;
+	uint16_t ofs = SD_EXTR_GEN_FIRST_EXT;
+	for (uint8_t numExt = SD_EXTR_GEN_NUM_EXT(buf); numExt != 0 && ofs + 48 <= SD_EXTR_BSIZE; --numExt) {
+		if (SD_EXTR_EXT_SFC(buf, ofs) == SD_EXTR_SFC_PERF_ENHANCEMENT && SD_EXTR_EXT_NUM_REGS(buf, ofs) != 0) {
+			regAddr = SD_EXTR_EXT_REG_ADDR(buf, ofs);
+			break;
+		}
+		ofs = SD_EXTR_EXT_NEXT(buf, ofs);
+	}
+	const uint8_t fno = SD_EXTR_REG_FNO(regAddr);
+	const uint8_t page = SD_EXTR_REG_PAGE(regAddr);
+	const uint16_t enableOffset = SD_EXTR_REG_OFFSET(regAddr) + SD_EXTR_PERF_CMDQ_ENABLE;
+	if (fno == 0 || enableOffset >= SD_EXTR_BSIZE) {
+		return;
+	}
+
+	// Enable it and read it back to make sure the card accepted it
+	if (!sd_cmd49(fno, page, enableOffset, 1, buf)
+		|| !sd_cmd48(fno, page, enableOffset, 1, buf)
+		|| (buf[0] & 1) == 0) {
+		return;
+	}
+	sd_mmc_card->cmdq_depth = (cmdqSupport + 1 < SD_MMC_CMD_QUEUE_MAX_DEPTH) ? cmdqSupport + 1 : SD_MMC_CMD_QUEUE_MAX_DEPTH;
+	sd_mmc_debug("Command queueing enabled, depth %d\n\r", (int)sd_mmc_card->cmdq_depth);
+}
+
+#endif
+
 /**
  * \brief Select a card slot and initialize the associated driver
  *
@@ -1344,6 +1499,22 @@ static void sd_mmc_deselect_slot(void)
 	}
 }
 
+/**
+ * \brief Stop a read that has failed and deselect the card
+ *
+ * A multiple block read is stopped with CMD12, so that the card does not stay
+ * in the data state waiting to send the rest of its blocks.
+ */
+static void sd_mmc_abort_read_blocks(void)
+{
+	sd_mmc_nb_block_remaining = 0;
+	if (sd_mmc_nb_block_to_tranfer > 1) {
+		// The errors on this command are ignored, as at the end of a normal read
+		sd_mmc_card->iface->adtc_stop(SDMMC_CMD12_STOP_TRANSMISSION, 0);
+	}
+	sd_mmc_deselect_slot();
+}
+
 /**
  * \brief Initialize the SD card in SPI mode.
  *
@@ -1451,6 +1622,7 @@ static bool sd_mmc_mci_card_init(void)
 	sd_mmc_card->type = CARD_TYPE_SD;
 	sd_mmc_card->version = CARD_VER_UNKNOWN;
 	sd_mmc_card->rca = 0;
+	sd_mmc_card->cmdq_depth = 0;
 	sd_mmc_debug("Start SD card install\n\r");
 
 	// Card need of 74 cycles clock minimum to start
@@ -1551,6 +1723,10 @@ static bool sd_mmc_mci_card_init(void)
 		if (!sd_mmc_card->iface->send_cmd(SDMMC_CMD16_SET_BLOCKLEN, SD_MMC_BLOCK_SIZE)) {
 			return false;
 		}
+#ifdef SD_MMC_CMD_QUEUE_ENABLE
+		// SD MEMORY, Enable command queueing if the SD Status says the card supports it
+		sd_enable_cmd_queue();
+#endif
 	}
 	return true;
 }
@@ -1844,8 +2020,9 @@ sd_mmc_err_t sd_mmc_init_read_blocks(uint8_t slot, uint32_t start, uint16_t nb_b
 		arg = (start * SD_MMC_BLOCK_SIZE);
 	}
 
+	sd_mmc_nb_block_to_tranfer = nb_block;
 	if (!sd_mmc_card->iface->adtc_start(cmd, arg, SD_MMC_BLOCK_SIZE, nb_block, dmaAddr)) {
-		sd_mmc_deselect_slot();
+		sd_mmc_abort_read_blocks();
 		return SD_MMC_ERR_COMM;
 	}
 	// Check response
@@ -1854,12 +2031,11 @@ sd_mmc_err_t sd_mmc_init_read_blocks(uint8_t slot, uint32_t start, uint16_t nb_b
 		if (resp & CARD_STATUS_ERR_RD_WR) {
 			sd_mmc_debug("%s: Read blocks %02d resp32 0x%08x CARD_STATUS_ERR_RD_WR\n\r",
 					__func__, (int)SDMMC_CMD_GET_INDEX(cmd), resp);
-			sd_mmc_deselect_slot();
+			sd_mmc_abort_read_blocks();
 			return SD_MMC_ERR_COMM;
 		}
 	}
 	sd_mmc_nb_block_remaining = nb_block;
-	sd_mmc_nb_block_to_tranfer = nb_block;
 	return SD_MMC_OK;
 }
 
@@ -1871,8 +2047,7 @@ sd_mmc_err_t sd_mmc_start_read_blocks(void *dest, uint16_t nb_block)
 	Assert(sd_mmc_nb_block_remaining >= nb_block);
 
 	if (!sd_mmc_card->iface->start_read_blocks(dest, nb_block)) {
-		sd_mmc_nb_block_remaining = 0;
-		sd_mmc_deselect_slot();
+		sd_mmc_abort_read_blocks();
 		return SD_MMC_ERR_COMM;
 	}
 	sd_mmc_nb_block_remaining -= nb_block;
@@ -1885,7 +2060,7 @@ sd_mmc_err_t sd_mmc_start_read_blocks(void *dest, uint16_t nb_block)
 sd_mmc_err_t sd_mmc_wait_end_of_read_blocks(bool abort)
 {
 	if (!sd_mmc_card->iface->wait_end_of_read_blocks()) {
-		sd_mmc_deselect_slot();
+		sd_mmc_abort_read_blocks();
 		return SD_MMC_ERR_COMM;
 	}
 	if (abort) {
@@ -1911,6 +2086,15 @@ sd_mmc_err_t sd_mmc_wait_end_of_read_blocks(bool abort)
 	return SD_MMC_OK;
 }
 
+// Get the number of read tasks that may be queued on the card, or 0 if command queueing is not in use
+uint8_t sd_mmc_get_queue_depth(uint8_t slot)
+{
+	if (slot >= SD_MMC_MEM_CNT || sd_mmc_cards[slot].state != SD_MMC_CARD_STATE_READY) {
+		return 0;
+	}
+	return sd_mmc_cards[slot].cmdq_depth;
+}
+
 // Initialise for writing blocks
 // On entry the card is not selected
 // If SD_MMC_OK is returned then the card is selected, otherwise it is not selected
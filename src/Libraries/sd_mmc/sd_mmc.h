@@ -214,6 +214,17 @@ sd_mmc_err_t sd_mmc_start_read_blocks(void *dest, uint16_t nb_block) noexcept;
  */
 sd_mmc_err_t sd_mmc_wait_end_of_read_blocks(bool abort) noexcept;
 
+/**
+ * \brief Get the number of read tasks that may be queued on the card.
+ *
+ * Command queueing is enabled during initialisation on SD cards whose SD Status says they support it (A2 class cards).
+ *
+ * \param slot     Card slot to use
+ *
+ * \return Queue depth, or 0 if the card is not ready or command queueing is not in use.
+ */
+uint8_t sd_mmc_get_queue_depth(uint8_t slot) noexcept;
+
 /**
  * \brief Initialize the write blocks of data
  *
@@ -321,7 +321,7 @@ typedef uint32_t sdmmc_cmd_def_t;
 /** ACMD6(ac, R1): Define the data bus width */
 #define SD_ACMD6_SET_BUS_WIDTH           (6 | SDMMC_CMD_R1)
 /** ACMD13(adtc, R1): Send the SD Status. */
-#define SD_ACMD13_SD_STATUS              (13 | SDMMC_CMD_R1)
+#define SD_ACMD13_SD_STATUS              (13 | SDMMC_CMD_R1 | SDMMC_CMD_SINGLE_BLOCK)
 /**
  * ACMD22(adtc, R1): Send the number of the written (with-out errors) write
  * blocks.
@@ -367,6 +367,28 @@ typedef uint32_t sdmmc_cmd_def_t;
 #define SDIO_CMD53_IO_W_BYTE_EXTENDED    (53 | SDMMC_CMD_R5 | SDMMC_CMD_SDIO_BYTE | SDMMC_CMD_WRITE)
 #define SDIO_CMD53_IO_R_BLOCK_EXTENDED   (53 | SDMMC_CMD_R5 | SDMMC_CMD_SDIO_BLOCK)
 #define SDIO_CMD53_IO_W_BLOCK_EXTENDED   (53 | SDMMC_CMD_R5 | SDMMC_CMD_SDIO_BLOCK | SDMMC_CMD_WRITE)
+
+/*
+ * --- Command queue commands (SD 6.00, class 1) ---
+ */
+/** SD Cmd43(ac, R1b): Abort a queued task or the whole queue */
+#define SD_CMD43_Q_MANAGEMENT            (43 | SDMMC_CMD_R1B)
+/** SD Cmd44(ac, R1): Queue a task - direction, priority, task ID and block count */
+#define SD_CMD44_Q_TASK_INFO_A           (44 | SDMMC_CMD_R1)
+/** SD Cmd45(ac, R1): Queue a task - start block address */
+#define SD_CMD45_Q_TASK_INFO_B           (45 | SDMMC_CMD_R1)
+/** SD Cmd46(adtc, R1): Execute a queued read task. The card stops after the queued block count. */
+#define SD_CMD46_Q_RD_TASK               (46 | SDMMC_CMD_R1 | SDMMC_CMD_MULTI_BLOCK)
+/** SD Cmd47(adtc, R1): Execute a queued write task. The card stops after the queued block count. */
+#define SD_CMD47_Q_WR_TASK               (47 | SDMMC_CMD_R1 | SDMMC_CMD_WRITE | SDMMC_CMD_MULTI_BLOCK)
+
+/*
+ * --- Function extension commands (SD 4.20, class 11) ---
+ */
+/** SD Cmd48(adtc, R1): Read a page of the extension register space */
+#define SD_CMD48_READ_EXTR_SINGLE        (48 | SDMMC_CMD_R1 | SDMMC_CMD_SINGLE_BLOCK)
+/** SD Cmd49(adtc, R1): Write to the extension register space */
+#define SD_CMD49_WRITE_EXTR_SINGLE       (49 | SDMMC_CMD_R1 | SDMMC_CMD_WRITE | SDMMC_CMD_SINGLE_BLOCK)
 //! @}
 //! @}
 
@@ -440,6 +462,36 @@ typedef uint32_t sdmmc_cmd_def_t;
   //! @{
 #define SD_ACMD41_HCS   (1lu << 30) //!< (SD) Host Capacity Support
   //! @}
+
+  //! \name SD command queue arguments
+  //! @{
+//! CMD13 arg[15] Return the Queue Status Register (one ready bit per task ID) instead of the card status
+#define SD_CMD13_SEND_TASK_STATUS   (1lu << 15)
+//! CMD43 arg[3:0] Operation code
+#define SD_CMD43_ABORT_QUEUE        (1lu << 0)
+#define SD_CMD43_ABORT_TASK         (2lu << 0)
+//! CMD44 arg[30] Data direction, arg[23] priority
+#define SD_CMD44_DIR_READ           (1lu << 30)
+#define SD_CMD44_PRIORITY           (1lu << 23)
+//! CMD43, CMD44, CMD46, CMD47 arg[20:16] Task ID
+#define SD_CMDQ_TASK_ID(id)         ((uint32_t)(id) << 16)
+//! CMD44 arg[15:0] Number of blocks
+#define SD_CMD44_BLOCK_COUNT(n)     ((uint32_t)(n) & 0xFFFF)
+#define SD_CMDQ_MAX_DEPTH           32
+  //! @}
+
+  //! \name SD CMD48/CMD49 arguments
+  //! @{
+//! arg[31] Memory (0) or I/O (1) extension
+//! arg[30:27] Function number
+#define SD_EXTR_FNO(fno)            ((uint32_t)(fno) << 27)
+//! arg[26] Mask write (CMD49 only)
+#define SD_EXTR_MW                  (1lu << 26)
+//! arg[25:9] Register address: page number and offset within the page
+#define SD_EXTR_ADDR(page, offset)  ((((uint32_t)(page) << 9) | (uint32_t)(offset)) << 9)
+//! arg[8:0] Length - 1, or the bit mask for a mask write
+#define SD_EXTR_LEN(len)            ((uint32_t)(len) - 1)
+  //! @}
 //! @}
 
 
@@ -890,7 +942,41 @@ static inline uint32_t SDMMC_UNSTUFF_BITS(uint8_t *reg, uint16_t reg_size,
 
   //! \name SD Status Field
   //! @{
+#define SD_STATUS_BIT_SIZE 512
 #define SD_STATUS_BSIZE    (512 / 8)  /**< 512 bits, 64bytes */
+#define SD_STATUS_STRUCTURE(status, pos, size) \
+		SDMMC_UNSTUFF_BITS(status, SD_STATUS_BIT_SIZE, pos, size)
+#define SD_STATUS_APP_PERF_CLASS(status)   SD_STATUS_STRUCTURE(status, 336, 4)
+#define   SD_STATUS_APP_PERF_CLASS_A1        1
+#define   SD_STATUS_APP_PERF_CLASS_A2        2
+//! Command queue depth - 1, or 0 if the card does not support command queueing (PERFORMANCE_ENHANCE bits 7:3)
+#define SD_STATUS_CMDQ_SUPPORT(status)     SD_STATUS_STRUCTURE(status, 331, 5)
+  //! @}
+
+  //! \name SD Extension Register Space
+  //! @{
+#define SD_EXTR_BSIZE                      512   //!< Size of a page
+//! General information page (function 0, page 0)
+#define SD_EXTR_GEN_REVISION(buf)          ((buf)[0] | ((uint16_t)(buf)[1] << 8))
+#define SD_EXTR_GEN_LENGTH(buf)            ((buf)[2] | ((uint16_t)(buf)[3] << 8))
+#define SD_EXTR_GEN_NUM_EXT(buf)           ((buf)[4])
+#define SD_EXTR_GEN_FIRST_EXT              16
+//! Extension descriptor within the general information page, at offset ofs
+#define SD_EXTR_EXT_SFC(buf, ofs)          ((buf)[ofs] | ((uint16_t)(buf)[(ofs) + 1] << 8))
+#define   SD_EXTR_SFC_POWER_MANAGEMENT       1
+#define   SD_EXTR_SFC_PERF_ENHANCEMENT       2
+#define SD_EXTR_EXT_NEXT(buf, ofs)         ((buf)[(ofs) + 40] | ((uint16_t)(buf)[(ofs) + 41] << 8))
+#define SD_EXTR_EXT_NUM_REGS(buf, ofs)     ((buf)[(ofs) + 42])
+#define SD_EXTR_EXT_REG_ADDR(buf, ofs)     ((buf)[(ofs) + 44] | ((uint32_t)(buf)[(ofs) + 45] << 8) \
+											| ((uint32_t)(buf)[(ofs) + 46] << 16) | ((uint32_t)(buf)[(ofs) + 47] << 24))
+//! Fields of a register set address
+#define SD_EXTR_REG_FNO(addr)              (((addr) >> 18) & 0x0F)
+#define SD_EXTR_REG_PAGE(addr)             (((addr) >> 9) & 0xFF)
+#define SD_EXTR_REG_OFFSET(addr)           ((addr) & 0x1FF)
+//! Performance enhancement register set, offsets from the start of the set
+#define SD_EXTR_PERF_CMDQ_SUPPORT          6     //!< [4:0] Queue depth - 1, or 0 if not supported
+#define SD_EXTR_PERF_CMDQ_ENABLE           262   //!< [0] Command queue enable
+#define SD_EXTR_PERF_CMDQ_MODE             263   //!< [0] 0 = voluntary (tasks may complete in any order), 1 = sequential
   //! @}
 
   //! \name MMC Extended CSD Register Field
@@ -21,16 +21,21 @@
 # include "flash_efc.h"
 #endif
 
-#include <General/SafeVsnprintf.h>
+#ifndef IAP_MINIMAL
+# include <General/SafeVsnprintf.h>
+#endif
 #include <General/StringFunctions.h>
+#include "IapKernels.h"
 
 #ifndef IAP_VIA_SPI
 # include "ff.h"
 # include "Libraries/sd_mmc/sd_mmc.h"
+# include "ElfSegments.h"
 #endif
 
 #include <cstdarg>
 #include <cstring>
+#include <type_traits>
 
 #define DEBUG	0
 
@@ -69,6 +74,12 @@ FIL upgradeBinary;
 const char* fwFile = defaultFwFile;
 uint32_t firmwareFileSize;
 bool isUf2File;
+bool isElfFile;
+bool firmwareFileOpen = false;					// the SD card is brought up while the flash is unlocked, and we can't erase or write until this is set
+uint32_t cardStartTime, lastCardCheckTime;
+
+ElfSegment elfSegments[maxElfSegments];		// loadable segments, sorted by flash address
+size_t numElfSegments;
 
 #endif
 
@@ -78,8 +89,25 @@ ProcessState state = Initializing;
 uint32_t pageSize;
 uint32_t flashPos = FirmwareFlashStart;
 
+VerifyLevel requestedVerifyLevel = VerifyFull;	// the level RepRapFirmware asked for
+VerifyLevel verifyLevel = VerifyFull;			// the level in use, which falls back to full verification after a CRC mismatch
+const char * const verifyLevelNames[NumVerifyLevels] = { "full", "CRC only", "sampled" };
+#ifndef IAP_VIA_SPI
+uint16_t imageCrc = 65535;						// CRC of the data written so far, when we don't verify every page
+#endif
+
 size_t retry = 0;
 size_t bytesRead, bytesWritten;
+
+// Statistics about how much recovering from errors has cost
+uint32_t totalRetries = 0;
+uint32_t retryStartTime;
+uint32_t retryMillis = 0;
+#ifdef IAP_VIA_SPI
+uint32_t numReflashes = 0;
+uint32_t reflashStartTime;
+uint32_t reflashMillis = 0;
+#endif
 bool haveDataInBuffer;
 const size_t reportPercentIncrement = 20;
 size_t reportNextPercent = reportPercentIncrement;
@@ -107,7 +135,40 @@ void delay_ms(uint32_t ms) noexcept
 	} while (millis() - startTime < ms);
 }
 
+#ifdef IAP_MINIMAL
+
+// The minimal build sends each message as a token followed by its arguments: numbers as 8 hex digits, strings as text between '|' characters.
+// The token is the FNV-1a hash of the format string, so neither the strings nor the formatting code end up in the binary.
+// tools/message_tokens.py makes the map from tokens to format strings when the minimal configurations are built, and decodes the messages.
+constexpr uint32_t MessageToken(const char *fmt, uint32_t hash = 2166136261u) noexcept
+{
+	return (*fmt == 0) ? hash : MessageToken(fmt + 1, (hash ^ (uint8_t)*fmt) * 16777619u);
+}
+
+// A message token or argument. Strings are sent as text, everything else as a number.
+struct MessageValue
+{
+	const char *text;
+	uint32_t number;
+
+	MessageValue(const char *s) noexcept : text(s), number(0) { }
+	template<typename T, typename = typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type>
+		MessageValue(T n) noexcept : text(nullptr), number((uint32_t)n) { }
+};
+
+void SendMessageTokens(const MessageValue *values, size_t numValues) noexcept;
+
+template<typename... Args> inline void MessageTokens(uint32_t token, Args... args) noexcept
+{
+	const MessageValue values[] = { token, args... };
+	SendMessageTokens(values, ARRAY_SIZE(values));
+}
+
+# define MessageF(fmt, ...)		MessageTokens(std::integral_constant<uint32_t, MessageToken(fmt)>::value, ##__VA_ARGS__)
+
+#else
 void MessageF(const char *fmt, ...) noexcept;			// forward declaration
+#endif
 
 #if defined(DEBUG) && DEBUG
 # define debugPrintf(...)		do { MessageF(__VA_ARGS__); delay_ms(1000); } while (false)
@@ -115,6 +176,52 @@ void MessageF(const char *fmt, ...) noexcept;			// forward declaration
 # define debugPrintf(...)		do { } while (false)
 #endif
 
+// Record that the current operation has failed and is going to be retried
+void RetryOperation() noexcept
+{
+	if (retry == 0)
+	{
+		retryStartTime = millis();
+	}
+	++retry;
+	++totalRetries;
+}
+
+// Record that the current operation has succeeded
+void OperationSucceeded() noexcept
+{
+	if (retry != 0)
+	{
+		retryMillis += millis() - retryStartTime;
+		retry = 0;
+	}
+}
+
+// Report how the update went
+void ReportStatistics() noexcept
+{
+	if (verifyLevel == requestedVerifyLevel)
+	{
+		MessageF("Verification level: %s", verifyLevelNames[verifyLevel]);
+	}
+	else
+	{
+		MessageF("Verification level: %s requested, fell back to %s", verifyLevelNames[requestedVerifyLevel], verifyLevelNames[verifyLevel]);
+	}
+	if (totalRetries != 0)
+	{
+		// If we are giving up, the failing operation has been retried for a while too
+		const uint32_t millisTaken = (retry != 0) ? retryMillis + (millis() - retryStartTime) : retryMillis;
+		MessageF("%" PRIu32 " retries took %" PRIu32 "ms", totalRetries, millisTaken);
+	}
+#ifdef IAP_VIA_SPI
+	if (numReflashes != 0)
+	{
+		MessageF("%" PRIu32 " re-flashes took %" PRIu32 "ms", numReflashes, reflashMillis);
+	}
+#endif
+}
+
 extern "C" void UrgentInit() noexcept { }
 
 extern "C" void SysTick_Handler(void) noexcept
@@ -204,15 +311,23 @@ extern "C" void AppMain() noexcept
 
 #ifdef IAP_VIA_SPI
 	memset(writeData, 0x1A, blockReadSize);
+	getVerifyLevel();
 #else
-	initFilesystem();
 	getFirmwareFileName();
-	openBinary();
+	getVerifyLevel();
+	initFilesystem();
 #endif
 
 	for (;;)
 	{
 		checkLed();
+#ifndef IAP_VIA_SPI
+		// Bring up the SD card and open the file while the flash is being unlocked
+		if (!firmwareFileOpen)
+		{
+			pollFilesystem();
+		}
+#endif
 		writeBinary();
 	}
 }
@@ -245,8 +360,8 @@ void setup_spi(size_t bytesToTransfer) noexcept
 	DMAC->DMAC_EBCISR;		// clear any pending interrupts
 
 	// Initialize channel config for transmitter
-	dmac_channel_set_source_addr(DMAC, DmacChanSbcTx, reinterpret_cast<uint32_t>(writeData));
-	dmac_channel_set_destination_addr(DMAC, DmacChanSbcTx, reinterpret_cast<uint32_t>(&(SBC_SPI->SPI_TDR)));
+	dmac_channel_set_source_addr(DMAC, DmacChanSbcTx, reinterpret_cast<uintptr_t>(writeData));
+	dmac_channel_set_destination_addr(DMAC, DmacChanSbcTx, reinterpret_cast<uintptr_t>(&(SBC_SPI->SPI_TDR)));
 	dmac_channel_set_descriptor_addr(DMAC, DmacChanSbcTx, 0);
 	dmac_channel_set_ctrlA(DMAC, DmacChanSbcTx,
 			bytesToTransfer |
@@ -260,8 +375,8 @@ void setup_spi(size_t bytesToTransfer) noexcept
 		DMAC_CTRLB_DST_INCR_FIXED);
 
 	// Initialize channel config for receiver
-	dmac_channel_set_source_addr(DMAC, DmacChanSbcRx, reinterpret_cast<uint32_t>(&(SBC_SPI->SPI_RDR)));
-	dmac_channel_set_destination_addr(DMAC, DmacChanSbcRx, reinterpret_cast<uint32_t>(readData));
+	dmac_channel_set_source_addr(DMAC, DmacChanSbcRx, reinterpret_cast<uintptr_t>(&(SBC_SPI->SPI_RDR)));
+	dmac_channel_set_destination_addr(DMAC, DmacChanSbcRx, reinterpret_cast<uintptr_t>(readData));
 	dmac_channel_set_descriptor_addr(DMAC, DmacChanSbcRx, 0);
 	dmac_channel_set_ctrlA(DMAC, DmacChanSbcRx,
 			bytesToTransfer |
@@ -416,78 +531,38 @@ bool is_spi_transfer_complete() noexcept
 # endif
 }
 
-uint16_t CRC16(const char *buffer, size_t length) noexcept
-{
-	const uint16_t crc16_table[] = {
-        0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
-        0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
-        0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
-        0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841,
-        0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40,
-        0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
-        0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
-        0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040,
-        0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
-        0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441,
-        0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
-        0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
-        0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41,
-        0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
-        0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
-        0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041,
-        0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240,
-        0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
-        0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41,
-        0xAA01, 0x6AC0, 0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840,
-        0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
-        0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
-        0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640,
-        0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
-        0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241,
-        0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440,
-        0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
-        0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
-        0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40,
-        0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
-        0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
-        0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040
-    };
-
-    uint16_t Crc = 65535;
-    uint16_t x;
-    for (size_t i = 0; i < length; i++)
-    {
-        x = (uint16_t)(Crc ^ buffer[i]);
-        Crc = (uint16_t)((Crc >> 8) ^ crc16_table[x & 0x00FF]);
-    }
-
-    return Crc;
-}
-
 #else
 
+// Start bringing up the SD card. The rest is done by pollFilesystem(), so that we don't have to wait for the card before unlocking the flash.
 void initFilesystem() noexcept
 {
 	debugPrintf("Initialising SD card");
 
 	memset(&fs, 0, sizeof(FATFS));
 	sd_mmc_init(SdWriteProtectPins, SdSpiCSPins);
-	delay_ms(20);
+	cardStartTime = lastCardCheckTime = millis();
+}
 
-	const size_t startTime = millis();
-	sd_mmc_err_t err;
-	do {
-		err = sd_mmc_check(0);
-		if (err > SD_MMC_ERR_NO_CARD)
-		{
-			break;
-		}
-		delay_ms(1);
-	} while (err != SD_MMC_OK && millis() - startTime < 5000);
+// Check the SD card at most once per millisecond until it is ready, then mount it and open the firmware file.
+// This is called from the main loop between flash operations until firmwareFileOpen is set.
+void pollFilesystem() noexcept
+{
+	const uint32_t now = millis();
+	if (now - cardStartTime < cardSettleTime || now == lastCardCheckTime)
+	{
+		return;
+	}
+	lastCardCheckTime = now;
 
+	const sd_mmc_err_t err = sd_mmc_check(0);
 	if (err == SD_MMC_OK)
 	{
 		MessageF("SD card initialised OK");
+		debugPrintf("SD card command queue depth %u", (unsigned int)sd_mmc_get_queue_depth(0));
+	}
+	else if (err <= SD_MMC_ERR_NO_CARD && millis() - cardStartTime < cardSettleTime + cardInitTimeout)
+	{
+		return;
 	}
 	else
 	{
@@ -525,6 +600,9 @@ void initFilesystem() noexcept
 		MessageF("SD card mount failed, code %d", mounted);
 		Reset(false);
 	}
+
+	openBinary();
+	firmwareFileOpen = true;
 }
 
 // Determine the name of the firmware file we need to flash
@@ -544,6 +622,86 @@ void getFirmwareFileName() noexcept
 	}
 	fwFile = fwFilePtr;		// replace default filename by the one we were passed
 	isUf2File = StringEndsWithIgnoreCase(fwFile, ".uf2");
+	isElfFile = StringEndsWithIgnoreCase(fwFile, ".elf");
+}
+
+// Read the program headers of an ELF firmware file once and record the segments we need to write to flash
+void getElfSegments() noexcept
+{
+	size_t locBytesRead;
+	const Elf32_Header * const header = reinterpret_cast<const Elf32_Header*>(readData);
+	if (   f_read(&upgradeBinary, readData, sizeof(Elf32_Header), &locBytesRead) != FR_OK
+		|| locBytesRead != sizeof(Elf32_Header)
+		|| CheckElfHeader(*header, firmwareFileSize, blockReadSize) != ElfError::none
+	   )
+	{
+		MessageF("ERROR: File %s is not a valid ELF firmware file", fwFile);
+		Reset(false);
+	}
+
+	const size_t numProgramHeaders = header->phnum;
+	const size_t programHeadersSize = numProgramHeaders * sizeof(Elf32_ProgramHeader);
+	if (   f_lseek(&upgradeBinary, header->phoff) != FR_OK
+		|| f_read(&upgradeBinary, readData, programHeadersSize, &locBytesRead) != FR_OK
+		|| locBytesRead != programHeadersSize
+	   )
+	{
+		MessageF("ERROR: Could not read ELF program headers from file %s", fwFile);
+		Reset(false);
+	}
+
+	uint32_t errorAddress;
+	switch (GetElfSegments(reinterpret_cast<const Elf32_ProgramHeader*>(readData), numProgramHeaders, firmwareFileSize,
+							FirmwareFlashStart, FirmwareFlashEnd, elfSegments, maxElfSegments, numElfSegments, errorAddress))
+	{
+	case ElfError::none:
+		break;
+
+	case ElfError::segmentOutsideFlash:
+		MessageF("ERROR: ELF segment at 0x%08" PRIx32 " does not fit in the firmware area", errorAddress);
+		Reset(false);
+		break;
+
+	case ElfError::segmentPastEndOfFile:
+		MessageF("ERROR: ELF segment at 0x%08" PRIx32 " runs past the end of the file", errorAddress);
+		Reset(false);
+		break;
+
+	case ElfError::tooManySegments:
+		MessageF("ERROR: File %s has too many ELF segments", fwFile);
+		Reset(false);
+		break;
+
+	case ElfError::segmentsOverlap:
+		MessageF("ERROR: ELF segments overlap at 0x%08" PRIx32, errorAddress);
+		Reset(false);
+		break;
+
+	default:
+		MessageF("ERROR: File %s has no loadable ELF segments", fwFile);
+		Reset(false);
+		break;
+	}
+}
+
+// Open the firmware file. A disk error may be transient, so it is retried a few times before we give up.
+FRESULT OpenFirmwareFile() noexcept
+{
+	const uint32_t startTime = millis();
+	size_t attempts = 0;
+	FRESULT result;
+	while ((result = f_open(&upgradeBinary, fwFile, FA_OPEN_EXISTING | FA_READ)) == FR_DISK_ERR && attempts < maxRetries)
+	{
+		++attempts;
+		delay_ms(readRetryDelay);
+	}
+	if (attempts != 0)
+	{
+		// These don't go through RetryOperation(), because the flash may be being unlocked at the same time
+		totalRetries += attempts;
+		retryMillis += millis() - startTime;
+	}
+	return result;
 }
 
 // Open the upgrade binary file so we can use it for flashing
@@ -551,33 +709,36 @@ void openBinary() noexcept
 {
 	debugPrintf("Opening firmware binary");
 
-	// Check if this file doesn't exceed our boundaries
-	FILINFO info;
-	info.lfname = nullptr;
-	if (f_stat(fwFile, &info) != FR_OK)
+	// Try to open the file. We take the size from the open file, so that we don't need f_stat().
+	const FRESULT result = OpenFirmwareFile();
+	if (result == FR_NO_FILE || result == FR_NO_PATH)
 	{
 		MessageF("ERROR: Could not find file %s", fwFile);
 		Reset(false);
 	}
+	else if (result != FR_OK)
+	{
+		MessageF("ERROR: Could not open file %s", fwFile);
+		Reset(false);
+	}
 
+	// Check if this file doesn't exceed our boundaries
 	size_t maxFirmwareFileSize = FirmwareFlashEnd - FirmwareFlashStart;
 	if (isUf2File)
 	{
 		maxFirmwareFileSize *= 2;
 	}
-	if (info.fsize > maxFirmwareFileSize)
+	if (upgradeBinary.fsize > maxFirmwareFileSize && !isElfFile)			// ELF files carry symbols too, so their segments are checked instead
 	{
 		MessageF("ERROR: File %s is too big", fwFile);
 		Reset(false);
 	}
 
-	firmwareFileSize = info.fsize;
+	firmwareFileSize = upgradeBinary.fsize;
 
-	// Try to open the file
-	if (f_open(&upgradeBinary, fwFile, FA_OPEN_EXISTING | FA_READ) != FR_OK)
+	if (isElfFile)
 	{
-		MessageF("ERROR: Could not open file %s", fwFile);
-		Reset(false);
+		getElfSegments();
 	}
 
 	MessageF("File %s opened", fwFile);
@@ -590,7 +751,9 @@ void ShowProgress() noexcept
 #ifdef IAP_VIA_SPI
 	const uint32_t totalSize = FirmwareFlashEnd - FirmwareFlashStart;		//TODO is there a way of knowing the total file size?
 #else
-	const uint32_t totalSize = (isUf2File) ? firmwareFileSize/2 : firmwareFileSize;
+	const uint32_t totalSize = (isElfFile) ? elfSegments[numElfSegments - 1].flashEnd - FirmwareFlashStart
+								: (isUf2File) ? firmwareFileSize/2
+									: firmwareFileSize;
 #endif
 	const size_t percentDone = (100 * (flashPos - FirmwareFlashStart))/totalSize;
 	if (percentDone >= reportNextPercent)
@@ -600,18 +763,54 @@ void ShowProgress() noexcept
 	}
 }
 
-// Check whether an areas of flash is erased
-bool IsSectorErased(uint32_t addr, uint32_t sectorSize)
+// Determine how thoroughly we should check the new firmware.
+// RepRapFirmware may store the verification level just above the stack, after the firmware filename if it passes one.
+// It is stored as verifyLevelTag followed by a single digit. If we don't find it we do full verification.
+void getVerifyLevel() noexcept
 {
-	// Check that the sector really is erased
-	for (uint32_t p = addr; p < addr + sectorSize; p += sizeof(uint32_t))
+	const uint32_t vtab = SCB->VTOR & SCB_VTOR_TBLOFF_Msk;
+	const uint32_t stackTop = *reinterpret_cast<const uint32_t*>(vtab);
+	const char *p = reinterpret_cast<const char*>(stackTop);
+#ifndef IAP_VIA_SPI
+	if (fwFile == p)
+	{
+		p += strlen(fwFile) + 1;
+	}
+#endif
+	for (size_t i = 0; verifyLevelTag[i] != 0; ++i, ++p)
 	{
-		if (*reinterpret_cast<const uint32_t*>(p) != 0xFFFFFFFF)
+		if (*p != verifyLevelTag[i])
 		{
-			return false;
+			return;
 		}
 	}
-	return true;
+	if (*p >= '0' && *p < '0' + NumVerifyLevels)
+	{
+		requestedVerifyLevel = static_cast<VerifyLevel>(*p - '0');
+		verifyLevel = requestedVerifyLevel;
+	}
+}
+
+// Decide whether to read back the page we have just written
+bool ShouldVerifyPage() noexcept
+{
+	switch (verifyLevel)
+	{
+	case VerifyFull:
+		return true;
+
+	case VerifySampled:
+		return ((flashPos - FirmwareFlashStart)/pageSize) % verifySampleInterval == 0;
+
+	default:
+		return false;
+	}
+}
+
+// Check whether an areas of flash is erased
+bool IsSectorErased(uint32_t addr, uint32_t sectorSize) noexcept
+{
+	return IsBlank(reinterpret_cast<const void *>(addr), sectorSize);
 }
 
 #ifdef IAP_VIA_SPI
@@ -653,24 +852,18 @@ bool ReadBlock()
 
 #else
 
-struct UF2_Block
+// Prepare to retry a failed seek or read.
+// After a disk error FatFs refuses all further access to the file, so open it again. If that fails too, the next attempt fails and we come back here.
+void RetryRead() noexcept
 {
-	// 32 byte header
-	uint32_t magicStart0;
-	uint32_t magicStart1;
-	uint32_t flags;
-	uint32_t targetAddr;
-	uint32_t payloadSize;
-	uint32_t blockNo;
-	uint32_t numBlocks;
-	uint32_t fileSize;		// or familyID
-	uint8_t data[476];
-	uint32_t magicEnd;
-
-	static constexpr uint32_t MagicStart0Val = 0x0A324655;
-	static constexpr uint32_t MagicStart1Val = 0x9E5D5157;
-	static constexpr uint32_t MagicEndVal = 0x0AB16F30;
-};
+	delay_ms(readRetryDelay);
+	RetryOperation();
+	if (f_error(&upgradeBinary))
+	{
+		f_close(&upgradeBinary);
+		(void)f_open(&upgradeBinary, fwFile, FA_OPEN_EXISTING | FA_READ);
+	}
+}
 
 // Read a block of data into the buffer, when the file is a .uf2 file
 // We rely on Duet .uf2 files always being sequential and having 256 bytes of data per 512 byte block
@@ -684,8 +877,7 @@ bool ReadBlockUf2()
 	if (result != FR_OK)
 	{
 		debugPrintf("WARNING: f_lseek returned err %d", result);
-		delay_ms(100);
-		retry++;
+		RetryRead();
 		return false;
 	}
 
@@ -704,39 +896,100 @@ bool ReadBlockUf2()
 		if (result != FR_OK)
 		{
 			debugPrintf("WARNING: f_read returned err %d", result);
-			delay_ms(100);
-			retry++;
+			RetryRead();
 			return false;
 		}
 		if (locBytesRead != sizeof(uf2Buffer))
 		{
 			//TODO just quit?
 			debugPrintf("WARNING: UF2 block read returned only %u bytes", locBytesRead);
-			delay_ms(100);
-			retry++;
+			RetryRead();
 			return false;
 		}
-		if (uf2Buffer.magicStart0 !=UF2_Block:: MagicStart0Val || uf2Buffer.magicStart1 != UF2_Block::MagicStart1Val || uf2Buffer.magicEnd != UF2_Block::MagicEndVal)
+		const Uf2Error error = CopyUf2Block(uf2Buffer, flashPos + bytesRead, readData + bytesRead);
+		if (error == Uf2Error::badBlock)
 		{
 			//TODO just quit?
 			MessageF("ERROR: bad UF2 block at offset %" PRIu32, seekPos + bytesRead);
 			Reset(false);
 			return false;
 		}
-		if (uf2Buffer.targetAddr != flashPos + bytesRead || uf2Buffer.payloadSize != 256)
+		if (error != Uf2Error::none)
 		{
 			//TODO just quit?
 			MessageF("ERROR: unexpected data in UF2 block at offset %" PRIu32, seekPos + bytesRead);
 			Reset(false);
 			return false;
 		}
-		memcpy(readData + bytesRead, uf2Buffer.data, 256);
-		bytesRead += 256;
+		bytesRead += UF2_Block::DuetPayloadSize;
 	} while (bytesRead < blockReadSize);
 
 	return true;
 }
 
+// Read a block of data into the buffer, when the file is an ELF file
+// Only the bytes of the loadable segments are read. Anything in between is left as 0xFF in the buffer.
+bool ReadBlockElf()
+{
+	// Find the first segment that still has data to be written
+	size_t seg = 0;
+	while (seg < numElfSegments && elfSegments[seg].flashEnd <= flashPos)
+	{
+		++seg;
+	}
+
+	memset(readData, 0xFF, blockReadSize);
+	if (seg == numElfSegments)
+	{
+		bytesRead = 0;
+		return true;
+	}
+
+#if SAM4E || SAM4S || SAME70 || SAME5x
+	// The flash has been erased already, so we can skip whole blocks in the gap before the next segment
+	if (elfSegments[seg].flashStart >= flashPos + blockReadSize)
+	{
+		const uint32_t newFlashPos = FirmwareFlashStart + ((elfSegments[seg].flashStart - FirmwareFlashStart) & ~(blockReadSize - 1));
+		if (verifyLevel != VerifyFull)
+		{
+			// The blocks we skip stay erased, so the image CRC must include them as such. The buffer is all 0xFF at this point.
+			for (uint32_t pos = flashPos; pos < newFlashPos; pos += blockReadSize)
+			{
+				imageCrc = CRC16(readData, blockReadSize, imageCrc);
+			}
+		}
+		flashPos = newFlashPos;
+	}
+#endif
+
+	const uint32_t blockEnd = flashPos + blockReadSize;
+	for (size_t i = seg; i < numElfSegments && elfSegments[i].flashStart < blockEnd; ++i)
+	{
+		const uint32_t start = (elfSegments[i].flashStart > flashPos) ? elfSegments[i].flashStart : flashPos;
+		const uint32_t end = (elfSegments[i].flashEnd < blockEnd) ? elfSegments[i].flashEnd : blockEnd;
+		FRESULT result = f_lseek(&upgradeBinary, elfSegments[i].fileOffset + (start - elfSegments[i].flashStart));
+		if (result != FR_OK)
+		{
+			debugPrintf("WARNING: f_lseek returned err %d", result);
+			RetryRead();
+			return false;
+		}
+
+		size_t locBytesRead;
+		result = f_read(&upgradeBinary, readData + (start - flashPos), end - start, &locBytesRead);
+		if (result != FR_OK || locBytesRead != end - start)
+		{
+			debugPrintf("WARNING: f_read returned err %d", result);
+			RetryRead();
+			return false;
+		}
+	}
+
+	const uint32_t imageEnd = elfSegments[numElfSegments - 1].flashEnd;
+	bytesRead = (imageEnd < blockEnd) ? imageEnd - flashPos : blockReadSize;
+	return true;
+}
+
 // Read a block of data into the buffer.
 // If successful, return true with bytesRead being the amount of data read (may be zero).
 bool ReadBlock()
@@ -752,13 +1005,17 @@ bool ReadBlock()
 		return ReadBlockUf2();
 	}
 
+	if (isElfFile)
+	{
+		return ReadBlockElf();
+	}
+
 	// Seek to the correct place in case we are doing retries
 	FRESULT result = f_lseek(&upgradeBinary, flashPos - FirmwareFlashStart);
 	if (result != FR_OK)
 	{
 		debugPrintf("WARNING: f_lseek returned err %d", result);
-		delay_ms(100);
-		retry++;
+		RetryRead();
 		return false;
 	}
 
@@ -766,14 +1023,21 @@ bool ReadBlock()
 	if (result != FR_OK)
 	{
 		debugPrintf("WARNING: f_read returned err %d", result);
-		delay_ms(100);
-		retry++;
+		RetryRead();
 		return false;
 	}
 
 	// Have we finished the file?
 	if (bytesRead < blockReadSize)
 	{
+		// A short read before the end of the file must not be mistaken for the end of the firmware
+		if (flashPos - FirmwareFlashStart + bytesRead != firmwareFileSize)
+		{
+			debugPrintf("WARNING: f_read returned only %u bytes", bytesRead);
+			RetryRead();
+			return false;
+		}
+
 		// Yes, now we just need to fill up the remaining part of the buffer with 0xFF
 		memset(readData + bytesRead, 0xFF, blockReadSize - bytesRead);
 	}
@@ -789,6 +1053,7 @@ void writeBinary()
 	if (retry > maxRetries)
 	{
 		MessageF("ERROR: Operation %d failed after %d retries", (int)state, maxRetries);
+		ReportStatistics();
 		Reset(false);
 	}
 	else if (retry > 0)
@@ -817,7 +1082,7 @@ void writeBinary()
 			}
 			else
 			{
-				++retry;
+				RetryOperation();
 			}
 # else
 			// Unlock each single page
@@ -827,11 +1092,11 @@ void writeBinary()
 			if (ok)
 			{
 				flashPos += pageSize;
-				retry = 0;
+				OperationSucceeded();
 			}
 			else
 			{
-				retry++;
+				RetryOperation();
 				break;
 			}
 
@@ -853,6 +1118,13 @@ void writeBinary()
 
 #if SAM4E || SAM4S || SAME70 || SAME5x
 	case ErasingFlash:
+# ifndef IAP_VIA_SPI
+		// Don't erase anything until we know that the new firmware can be read, so that a missing file or a bad card leaves the old firmware intact
+		if (!firmwareFileOpen)
+		{
+			break;
+		}
+# endif
 		debugPrintf("Erasing 0x%08x", flashPos);
 		if (retry != 0)
 		{
@@ -884,20 +1156,20 @@ void writeBinary()
 			if (IsSectorErased(flashPos, sectorSize) || flash_erase_sector(flashPos) == FLASH_RC_OK)
 #endif
 			{
-				// Check that the sector really is erased
-				if (IsSectorErased(flashPos, sectorSize))
+				// Check that the sector really is erased, unless we rely on the flash controller status
+				if (verifyLevel != VerifyFull || (IsSectorErased(flashPos, sectorSize)))
 				{
-					retry = 0;
+					OperationSucceeded();
 					flashPos += sectorSize;
 				}
 				else
 				{
-					++retry;
+					RetryOperation();
 				}
 			}
 			else
 			{
-				++retry;
+				RetryOperation();
 			}
 
 			if (flashPos >= FirmwareFlashEnd)
@@ -915,6 +1187,12 @@ void writeBinary()
 #endif
 
 	case WritingUpgrade:
+#ifndef IAP_VIA_SPI
+		if (!firmwareFileOpen)
+		{
+			break;
+		}
+#endif
 		// Attempt to read a chunk from the firmware file or SBC
 		if (!haveDataInBuffer)
 		{
@@ -923,7 +1201,7 @@ void writeBinary()
 				break;
 			}
 			haveDataInBuffer = true;
-			retry = 0;
+			OperationSucceeded();
 			bytesWritten = 0;
 		}
 
@@ -935,32 +1213,44 @@ void writeBinary()
 				MessageF("Flash write retry #%u", retry);
 			}
 
+#if !defined(IAP_VIA_SPI) && (SAM4E || SAM4S || SAME70 || SAME5x)
+			// Pages of an ELF image that lie in a gap between segments are already erased, so don't program them
+			if (!(isElfFile && IsBlank(readData + bytesWritten, pageSize)))
+#endif
+			{
 #if SAME5x
-			const bool ok = Flash::Write(flashPos, pageSize, (uint8_t*)readData + bytesWritten);
+				const bool ok = Flash::Write(flashPos, pageSize, (uint8_t*)readData + bytesWritten);
 #else
-			cpu_irq_disable();
-			const bool ok =
+				cpu_irq_disable();
+				const bool ok =
 # if SAM4E || SAM4S || SAME70
-								flash_write(flashPos, readData + bytesWritten, pageSize, 0) == FLASH_RC_OK;
+									flash_write(flashPos, readData + bytesWritten, pageSize, 0) == FLASH_RC_OK;
 # else
-								flash_write(flashPos, readData + bytesWritten, pageSize, 1) == FLASH_RC_OK;
+									flash_write(flashPos, readData + bytesWritten, pageSize, 1) == FLASH_RC_OK;
 # endif
-			cpu_irq_enable();
+				cpu_irq_enable();
 #endif
-			if (!ok)
-			{
-				++retry;
-				break;
+				if (!ok)
+				{
+					RetryOperation();
+					break;
+				}
+
+				// Verify the written data
+				if (ShouldVerifyPage() && memcmp(readData + bytesWritten, reinterpret_cast<const void *>(flashPos), pageSize) != 0)
+				{
+					RetryOperation();
+					break;
+				}
 			}
 
-			// Verify the written data
-			if (memcmp(readData + bytesWritten, reinterpret_cast<const void *>(flashPos), pageSize) != 0)
+#ifndef IAP_VIA_SPI
+			if (verifyLevel != VerifyFull)
 			{
-				++retry;
-				break;
+				imageCrc = CRC16(readData + bytesWritten, pageSize, imageCrc);
 			}
-
-			retry = 0;
+#endif
+			OperationSucceeded();
 			bytesWritten += pageSize;
 			flashPos += pageSize;
 			ShowProgress();
@@ -973,6 +1263,16 @@ void writeBinary()
 					setup_spi(sizeof(FlashVerifyRequest));
 					state = VerifyingChecksum;
 #else
+					if (verifyLevel != VerifyFull && CRC16(reinterpret_cast<const char*>(FirmwareFlashStart), flashPos - FirmwareFlashStart, 65535) != imageCrc)
+					{
+						// Write the whole image again, this time reading back every page
+						MessageF("CRC mismatch, writing firmware again with full verification");
+						verifyLevel = VerifyFull;
+						flashPos = FirmwareFlashStart;
+						reportNextPercent = reportPercentIncrement;
+						state = UnlockingFlash;
+						break;
+					}
 					closeBinary();
 					state = LockingFlash;
 #endif
@@ -991,11 +1291,15 @@ void writeBinary()
 		else if (is_spi_transfer_complete())
 		{
 			const FlashVerifyRequest *request = reinterpret_cast<const FlashVerifyRequest*>(readData);
-			uint16_t crc16 = CRC16(reinterpret_cast<const char*>(FirmwareFlashStart), request->firmwareLength);
+			uint16_t crc16 = CRC16(reinterpret_cast<const char*>(FirmwareFlashStart), request->firmwareLength, 65535);
 			if (request->crc16 == crc16)
 			{
 				// Success!
 				debugPrintf("Checksum OK!");
+				if (numReflashes != 0)
+				{
+					reflashMillis += millis() - reflashStartTime;
+				}
 				writeData[0] = 0x0C;
 				state = SendingChecksumOK;
 			}
@@ -1003,10 +1307,15 @@ void writeBinary()
 			{
 				// Checksum mismatch
 				MessageF("CRC mismatch");
+				if (numReflashes == 0)
+				{
+					reflashStartTime = millis();
+				}
+				++numReflashes;
 				writeData[0] = 0xFF;
 				state = SendingChecksumError;
 			}
-			retry = 0;
+			OperationSucceeded();
 			setup_spi(1);
 		}
 		break;
@@ -1034,10 +1343,15 @@ void writeBinary()
 		}
 		else if (is_spi_transfer_complete())
 		{
-			// Attempt to flash the firmware again
+			// Attempt to flash the firmware again. Programming can only clear bits, so the pages we wrote must be erased first.
 			flashPos = FirmwareFlashStart;
+# if SAM4E || SAM4S || SAME70 || SAME5x
+			MessageF("Erasing flash");
+			state = ErasingFlash;
+# else
 			state = WritingUpgrade;
-			retry = 0;
+# endif
+			OperationSucceeded();
 		}
 		break;
 #endif
@@ -1052,12 +1366,13 @@ void writeBinary()
 			const uint32_t lockStart = FirmwareFlashStart & ~(Flash::GetLockRegionSize() - 1);
 			if (Flash::Lock(lockStart, FirmwareFlashEnd - lockStart))
 			{
+				ReportStatistics();
 				MessageF("Update successful! Rebooting...");
 				Reset(true);
 			}
 			else
 			{
-				++retry;
+				RetryOperation();
 			}
 # else
 			cpu_irq_disable();
@@ -1068,14 +1383,15 @@ void writeBinary()
 				flashPos += pageSize;
 				if (flashPos >= FirmwareFlashEnd)
 				{
+					ReportStatistics();
 					MessageF("Update successful! Rebooting...");
 					Reset(true);
 				}
-				retry = 0;
+				OperationSucceeded();
 			}
 			else
 			{
-				retry++;
+				RetryOperation();
 			}
 #endif
 		}
@@ -1096,11 +1412,17 @@ void Reset(bool success) noexcept
 	if (!success)
 	{
 		delay_ms(1500);				// give the user a chance to read the error message on PanelDue
-		// Only start from bootloader if the firmware couldn't be written entirely
-		if (state >= WritingUpgrade)
+		// Only start from bootloader if the firmware couldn't be written entirely.
+		// Nothing is erased or written before the firmware file has been opened.
+		if (   state >= WritingUpgrade
+#ifndef IAP_VIA_SPI
+			&& firmwareFileOpen
+#endif
+		   )
 		{
 			// If anything went wrong, write the last error message to Flash to the beginning
 			// of the Flash memory. That may help finding out what went wrong...
+			// In the minimal build this is the token message, which tools/message_tokens.py decodes.
 #if SAME5x
 			Flash::Unlock(FirmwareFlashStart, pageSize);
 			Flash::Write(FirmwareFlashStart, strlen(formatBuffer), (uint8_t*)formatBuffer);
@@ -1129,6 +1451,48 @@ void Reset(bool success) noexcept
 	while(true) { }
 }
 
+// Write the message in formatBuffer to PanelDue
+void SendFormatBuffer() noexcept
+{
+	SERIAL_AUX_DEVICE.print("{\"message\":\"");
+	SERIAL_AUX_DEVICE.print(formatBuffer);
+	SERIAL_AUX_DEVICE.print("\"}\n");
+	delay_ms(10);
+}
+
+#ifdef IAP_MINIMAL
+
+// Write a message token and its arguments to PanelDue
+void SendMessageTokens(const MessageValue *values, size_t numValues) noexcept
+{
+	char *p = formatBuffer;
+	char * const end = formatBuffer + ARRAY_SIZE(formatBuffer) - 1;
+	for (size_t i = 0; i < numValues && p + 9 <= end; ++i)
+	{
+		*p++ = (i == 0) ? '#' : ' ';
+		if (values[i].text != nullptr)
+		{
+			*p++ = '|';
+			for (const char *q = values[i].text; *q != 0 && p + 1 < end; ++q)
+			{
+				*p++ = *q;
+			}
+			*p++ = '|';
+		}
+		else
+		{
+			for (int shift = 28; shift >= 0; shift -= 4)
+			{
+				*p++ = "0123456789abcdef"[(values[i].number >> shift) & 0x0F];
+			}
+		}
+	}
+	*p = 0;
+	SendFormatBuffer();
+}
+
+#else
+
 // Write message to PanelDue
 // The message must not contain any characters that need JSON escaping, such as newline or " or \.
 void MessageF(const char *fmt, ...) noexcept
@@ -1137,13 +1501,11 @@ void MessageF(const char *fmt, ...) noexcept
 	va_start(vargs, fmt);
 	SafeVsnprintf(formatBuffer, ARRAY_SIZE(formatBuffer), fmt, vargs);
 	va_end(vargs);
-
-	SERIAL_AUX_DEVICE.print("{\"message\":\"");
-	SERIAL_AUX_DEVICE.print(formatBuffer);
-	SERIAL_AUX_DEVICE.print("\"}\n");
-	delay_ms(10);
+	SendFormatBuffer();
 }
 
+#endif
+
 // The following functions are called by the startup code in CoreNG.
 // We define our own versions here to make the binary smaller, because we don't use the associated functionality.
 void AnalogInInit() noexcept
@@ -244,6 +244,27 @@ struct FlashVerifyRequest
 const size_t blockReadSize = 2048;
 
 const size_t maxRetries = 5;											// Allow 5 retries max if anything goes wrong
+const uint32_t readRetryDelay = 100;									// How long to wait before retrying a failed read, in milliseconds
+#ifndef IAP_VIA_SPI
+const uint32_t cardSettleTime = 20;										// How long to give the SD card after initialising the interface, in milliseconds
+const uint32_t cardInitTimeout = 5000;									// How long to keep trying to initialise the SD card, in milliseconds
+#endif
+
+// How thoroughly the new firmware is checked
+enum VerifyLevel : uint8_t
+{
+	VerifyFull = 0,														// Read back every page and check every erased sector (default)
+	VerifyCrcOnly,														// Rely on the flash controller status and check the CRC of the whole image at the end
+	VerifySampled,														// As VerifyCrcOnly, but also read back one page in every verifySampleInterval
+	NumVerifyLevels
+};
+
+const uint32_t verifySampleInterval = 16;								// Number of pages per spot-check when using sampled verification
+const char * const verifyLevelTag = "IAPVL";							// Precedes the verification level digit passed by RepRapFirmware
+
+#ifndef IAP_VIA_SPI
+const size_t maxElfSegments = 8;										// Maximum number of loadable segments in an ELF firmware image
+#endif
 
 enum ProcessState
 {
@@ -262,15 +283,17 @@ enum ProcessState
 };
 
 #ifndef IAP_VIA_SPI
-void initFilesystem();
-void getFirmwareFileName();
-void openBinary();
-void closeBinary();
+void initFilesystem() noexcept;
+void pollFilesystem() noexcept;
+void getFirmwareFileName() noexcept;
+void openBinary() noexcept;
+void closeBinary() noexcept;
 #endif
 
+void getVerifyLevel() noexcept;
 void writeBinary();
-void Reset(bool success);
+void Reset(bool success) noexcept;
 
-void sendUSB(uint32_t ep, const void* d, uint32_t len);
+void sendUSB(uint32_t ep, const void* d, uint32_t len) noexcept;
 
 #endif	// IAP_H_INCLUDED
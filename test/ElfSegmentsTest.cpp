@@ -0,0 +1,209 @@
+/*
+ * ElfSegmentsTest.cpp
+ *
+ * Host test of the ELF firmware file checks. Each test builds a small sample ELF image in memory
+ * and parses it the same way as the IAP does: the ELF header first, then the program headers.
+ */
+
+#include "ElfSegments.h"
+#include "TestSupport.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+	const uint32_t FlashStart = 0x00400000;
+	const uint32_t FlashEnd = 0x004F0000;
+	const size_t MaxProgramHeadersSize = 2048;		// same as blockReadSize in the IAP
+	const size_t MaxSegments = 8;
+
+	unsigned int failures = 0;
+
+	Elf32_Header& HeaderOf(std::vector<uint8_t>& file)
+	{
+		return *reinterpret_cast<Elf32_Header*>(file.data());
+	}
+
+	struct Result
+	{
+		ElfError error;
+		size_t numSegments;
+		uint32_t errorAddress;
+		ElfSegment segments[MaxSegments];
+	};
+
+	Result Parse(const std::vector<uint8_t>& file)
+	{
+		Result r;
+		r.numSegments = 0;
+		r.errorAddress = 0;
+		Elf32_Header header;
+		if (file.size() < sizeof(header))
+		{
+			r.error = ElfError::notElfFile;
+			return r;
+		}
+		memcpy(&header, file.data(), sizeof(header));
+		r.error = CheckElfHeader(header, file.size(), MaxProgramHeadersSize);
+		if (r.error == ElfError::none)
+		{
+			std::vector<Elf32_ProgramHeader> programHeaders(header.phnum);
+			memcpy(programHeaders.data(), file.data() + header.phoff, header.phnum * sizeof(Elf32_ProgramHeader));
+			r.error = GetElfSegments(programHeaders.data(), header.phnum, file.size(), FlashStart, FlashEnd,
+										r.segments, MaxSegments, r.numSegments, r.errorAddress);
+		}
+		return r;
+	}
+
+	const uint32_t PT_LOAD = Elf32_ProgramHeader::TypeLoad;
+	const uint32_t PT_ARM_EXIDX = 0x70000001;
+}
+
+static void TestValidImage()
+{
+	// Headers deliberately out of address order; .bss and the RAM copy of .data have no file data or are not loadable
+	const std::vector<TestSegment> segs =
+	{
+		{ PT_LOAD,		FlashStart + 0x8000,	0x100,	0x100,	0 },		// .data load image
+		{ PT_LOAD,		0x20000000,				0,		0x4000,	0 },		// .bss in RAM
+		{ PT_ARM_EXIDX,	FlashStart + 0x7000,	0x20,	0x20,	0 },
+		{ PT_LOAD,		FlashStart,				0x7000,	0x7000,	0 },		// .text
+	};
+	const std::vector<uint8_t> file = MakeElf(segs);
+	const Result r = Parse(file);
+	CHECK(r.error == ElfError::none);
+	CHECK(r.numSegments == 2);
+	CHECK(r.segments[0].flashStart == FlashStart && r.segments[0].flashEnd == FlashStart + 0x7000);
+	CHECK(r.segments[1].flashStart == FlashStart + 0x8000 && r.segments[1].flashEnd == FlashStart + 0x8100);
+	CHECK(r.segments[0].fileOffset == sizeof(Elf32_Header) + 4 * sizeof(Elf32_ProgramHeader) + 0x100 + 0x20);
+	CHECK(file[r.segments[0].fileOffset] == 3 && file[r.segments[1].fileOffset] == 0);
+}
+
+static void TestSegmentEndingAtFlashEnd()
+{
+	const Result r = Parse(MakeElf({ { PT_LOAD, FlashEnd - 0x200, 0x200, 0x200, 0 } }));
+	CHECK(r.error == ElfError::none);
+	CHECK(r.numSegments == 1 && r.segments[0].flashEnd == FlashEnd);
+}
+
+static void TestOverlappingSegments()
+{
+	const Result r = Parse(MakeElf({ { PT_LOAD, FlashStart, 0x1000, 0x1000, 0 }, { PT_LOAD, FlashStart + 0xFFC, 0x10, 0x10, 0 } }));
+	CHECK(r.error == ElfError::segmentsOverlap);
+	CHECK(r.errorAddress == FlashStart + 0xFFC);
+
+	// Touching segments are fine
+	const Result r2 = Parse(MakeElf({ { PT_LOAD, FlashStart + 0x1000, 0x10, 0x10, 0 }, { PT_LOAD, FlashStart, 0x1000, 0x1000, 0 } }));
+	CHECK(r2.error == ElfError::none && r2.numSegments == 2);
+}
+
+static void TestSegmentOutsideFlash()
+{
+	const Result below = Parse(MakeElf({ { PT_LOAD, FlashStart - 0x100, 0x100, 0x100, 0 } }));
+	CHECK(below.error == ElfError::segmentOutsideFlash && below.errorAddress == FlashStart - 0x100);
+
+	const Result above = Parse(MakeElf({ { PT_LOAD, FlashEnd, 0x10, 0x10, 0 } }));
+	CHECK(above.error == ElfError::segmentOutsideFlash && above.errorAddress == FlashEnd);
+
+	const Result straddling = Parse(MakeElf({ { PT_LOAD, FlashEnd - 0x10, 0x20, 0x20, 0 } }));
+	CHECK(straddling.error == ElfError::segmentOutsideFlash && straddling.errorAddress == FlashEnd - 0x10);
+
+	// A huge size must not wrap around
+	std::vector<uint8_t> file = MakeElf({ { PT_LOAD, FlashStart, 0x10, 0x10, 0 } });
+	reinterpret_cast<Elf32_ProgramHeader*>(file.data() + sizeof(Elf32_Header))->filesz = 0xFFFFFFF0;
+	CHECK(Parse(file).error == ElfError::segmentOutsideFlash);
+}
+
+static void TestSegmentPastEndOfFile()
+{
+	std::vector<uint8_t> file = MakeElf({ { PT_LOAD, FlashStart, 0x100, 0x100, 0 } });
+	file.resize(file.size() - 1);									// truncated file
+	const Result r = Parse(file);
+	CHECK(r.error == ElfError::segmentPastEndOfFile && r.errorAddress == FlashStart);
+
+	const Result r2 = Parse(MakeElf({ { PT_LOAD, FlashStart, 0x100, 0x100, 0x10000 } }));		// offset beyond the end of the file
+	CHECK(r2.error == ElfError::segmentPastEndOfFile);
+}
+
+static void TestProgramHeaderOverflow()
+{
+	// More program headers than fit in the buffer
+	std::vector<uint8_t> file = MakeElf({ { PT_LOAD, FlashStart, 0x10, 0x10, 0 } });
+	HeaderOf(file).phnum = 0xFFFF;
+	CHECK(Parse(file).error == ElfError::badProgramHeaders);
+
+	HeaderOf(file).phnum = MaxProgramHeadersSize / sizeof(Elf32_ProgramHeader) + 1;
+	file.resize(0x10000);
+	CHECK(Parse(file).error == ElfError::badProgramHeaders);
+
+	// Program headers that run past the end of the file
+	std::vector<uint8_t> file2 = MakeElf({ { PT_LOAD, FlashStart, 0x10, 0x10, 0 } });
+	HeaderOf(file2).phnum = 3;
+	CHECK(Parse(file2).error == ElfError::badProgramHeaders);
+
+	HeaderOf(file2).phnum = 1;
+	HeaderOf(file2).phoff = 0xFFFFFFF0;
+	CHECK(Parse(file2).error == ElfError::badProgramHeaders);
+}
+
+static void TestBssOnly()
+{
+	const Result r = Parse(MakeElf({ { PT_LOAD, 0x20000000, 0, 0x1000, 0 }, { PT_LOAD, 0x20001000, 0, 0x200, 0 } }));
+	CHECK(r.error == ElfError::noLoadableSegments);
+	CHECK(Parse(MakeElf({})).error == ElfError::noLoadableSegments);
+}
+
+static void TestTooManySegments()
+{
+	std::vector<TestSegment> segs;
+	for (uint32_t i = 0; i <= MaxSegments; ++i)
+	{
+		segs.push_back({ PT_LOAD, FlashStart + i * 0x100, 0x10, 0x10, 0 });
+	}
+	CHECK(Parse(MakeElf(segs)).error == ElfError::tooManySegments);
+	segs.pop_back();
+	CHECK(Parse(MakeElf(segs)).error == ElfError::none);
+}
+
+static void TestNotElf()
+{
+	std::vector<uint8_t> file = MakeElf({ { PT_LOAD, FlashStart, 0x10, 0x10, 0 } });
+	std::vector<uint8_t> bad = file;
+	bad[0] = 0;
+	CHECK(Parse(bad).error == ElfError::notElfFile);
+	bad = file;
+	bad[4] = 2;														// ELFCLASS64
+	CHECK(Parse(bad).error == ElfError::notElfFile);
+	bad = file;
+	bad[5] = 2;														// big endian
+	CHECK(Parse(bad).error == ElfError::notElfFile);
+	bad = file;
+	HeaderOf(bad).phentsize = 56;
+	CHECK(Parse(bad).error == ElfError::notElfFile);
+	CHECK(Parse(MakeElf({ { PT_LOAD, FlashStart, 0x10, 0x10, 0 } }, 62)).error == ElfError::notElfFile);		// x86-64
+}
+
+int main()
+{
+	TestValidImage();
+	TestSegmentEndingAtFlashEnd();
+	TestOverlappingSegments();
+	TestSegmentOutsideFlash();
+	TestSegmentPastEndOfFile();
+	TestProgramHeaderOverflow();
+	TestBssOnly();
+	TestTooManySegments();
+	TestNotElf();
+
+	if (failures != 0)
+	{
+		printf("ElfSegmentsTest: %u checks failed\n", failures);
+		return 1;
+	}
+	printf("ElfSegmentsTest: all checks passed\n");
+	return 0;
+}
+
+// End
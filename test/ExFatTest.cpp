@@ -0,0 +1,243 @@
+/*
+ * ExFatTest.cpp
+ *
+ * Host test of the read only exFAT support in FatFs. Each test builds an exFAT image in memory, edits the entry set of
+ * the file where it needs to, and reads the file back the way the IAP does.
+ */
+
+#include "TestSupport.h"
+#include "IapHarness/FatImage.h"
+#include "KernelBench/RamDisk.h"
+#include "ff.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+	const char * const DirName = "sys";
+	const char * const FileName = "DuetWiFiFirmware.bin";
+	const char * const FilePath = "0:/sys/DuetWiFiFirmware.bin";
+	const size_t ReadSize = 2048;					// the IAP's blockReadSize
+
+	unsigned int failures = 0;
+	FATFS fs;
+
+	std::vector<uint8_t> Contents(size_t size)
+	{
+		std::vector<uint8_t> data(size);
+		for (size_t i = 0; i < size; ++i)
+		{
+			data[i] = (uint8_t)(i * 37 + (i >> 9));
+		}
+		return data;
+	}
+
+	void Mount(const std::vector<uint8_t>& image)
+	{
+		SetRamDisk(image.data(), image.size() / 512);
+		f_mount(0, &fs);
+	}
+
+	// Read the whole file, returning the result of the first call that fails
+	FRESULT ReadFile(const std::vector<uint8_t>& image, std::vector<uint8_t>& data)
+	{
+		Mount(image);
+		data.clear();
+		FIL file;
+		FRESULT result = f_open(&file, FilePath, FA_OPEN_EXISTING | FA_READ);
+		while (result == FR_OK)
+		{
+			uint8_t buffer[ReadSize];
+			size_t bytesRead;
+			result = f_read(&file, buffer, sizeof(buffer), &bytesRead);
+			if (bytesRead == 0)
+			{
+				break;
+			}
+			data.insert(data.end(), buffer, buffer + bytesRead);
+		}
+		return result;
+	}
+
+	// The entry set of the file: the file entry, then the stream extension entry at offset 32
+	uint8_t *FindEntrySet(std::vector<uint8_t>& image)
+	{
+		for (size_t offset = 0; offset + 96 <= image.size(); offset += 32)
+		{
+			uint8_t * const set = image.data() + offset;
+			if (set[0] == 0x85 && set[32] == 0xC0 && set[35] == strlen(FileName) && set[64] == 0xC1 && set[66] == (uint8_t)FileName[0])
+			{
+				return set;
+			}
+		}
+		return nullptr;
+	}
+
+	void SetChecksum(uint8_t *set)
+	{
+		const uint16_t sum = ExFatSetChecksum(set, 1 + set[1]);
+		set[2] = (uint8_t)sum;
+		set[3] = (uint8_t)(sum >> 8);
+	}
+
+	void Put32(uint8_t *p, uint32_t val)
+	{
+		for (size_t i = 0; i < 4; ++i)
+		{
+			p[i] = (uint8_t)(val >> (8 * i));
+		}
+	}
+
+	const size_t StreamValidDataLength = 32 + 8;
+	const size_t StreamDataLength = 32 + 24;
+}
+
+static void TestReadFile()
+{
+	static const unsigned int clusterSectors[] = { 1, 8, 64 };
+	for (unsigned int sectors : clusterSectors)
+	{
+		for (bool fragmented : { false, true })
+		{
+			const std::vector<uint8_t> contents = Contents(300000 + sectors);
+			std::vector<uint8_t> data;
+			CHECK(ReadFile(MakeExFatImage(DirName, FileName, contents, sectors, fragmented), data) == FR_OK);
+			CHECK(data == contents);
+		}
+	}
+
+	std::vector<uint8_t> data;
+	CHECK(ReadFile(MakeExFatImage(DirName, FileName, std::vector<uint8_t>(), 8, false), data) == FR_OK);
+	CHECK(data.empty());
+}
+
+static void TestSeek()
+{
+	for (bool fragmented : { false, true })
+	{
+		const std::vector<uint8_t> contents = Contents(100000);
+		const std::vector<uint8_t> image = MakeExFatImage(DirName, FileName, contents, 4, fragmented);
+		Mount(image);
+		FIL file;
+		CHECK(f_open(&file, FilePath, FA_OPEN_EXISTING | FA_READ) == FR_OK);
+		static const size_t offsets[] = { 70000, 2048, 99990, 0, 4095 };		// forwards and backwards, on and off cluster boundaries
+		for (size_t offset : offsets)
+		{
+			uint8_t buffer[16];
+			size_t bytesRead;
+			CHECK(f_lseek(&file, offset) == FR_OK && file.fptr == offset);
+			CHECK(f_read(&file, buffer, sizeof(buffer), &bytesRead) == FR_OK);
+			const size_t expected = (contents.size() - offset < sizeof(buffer)) ? contents.size() - offset : sizeof(buffer);
+			CHECK(bytesRead == expected && memcmp(buffer, contents.data() + offset, expected) == 0);
+		}
+	}
+}
+
+static void TestListing()
+{
+	const std::vector<uint8_t> image = MakeExFatImage(DirName, FileName, Contents(5000), 8, false);
+	Mount(image);
+	DIR dir;
+	FILINFO info;
+	char longName[_MAX_LFN + 1];
+	info.lfname = longName;
+	info.lfsize = sizeof(longName);
+	CHECK(f_opendir(&dir, "0:/sys") == FR_OK);
+	CHECK(f_readdir(&dir, &info) == FR_OK && strcmp(longName, FileName) == 0 && info.fsize == 5000 && !(info.fattrib & AM_DIR));
+	CHECK(f_readdir(&dir, &info) == FR_OK && info.fname[0] == 0);		// end of the directory
+}
+
+// A changed entry set must fail its checksum, so that a corrupt size or start cluster is never used
+static void TestSetChecksum()
+{
+	std::vector<uint8_t> image = MakeExFatImage(DirName, FileName, Contents(5000), 8, false);
+	uint8_t * const set = FindEntrySet(image);
+	CHECK(set != nullptr);
+	if (set != nullptr)
+	{
+		std::vector<uint8_t> data;
+		set[StreamDataLength] ^= 0x40;
+		CHECK(ReadFile(image, data) == FR_INT_ERR);
+		SetChecksum(set);
+		CHECK(ReadFile(image, data) == FR_OK);
+
+		set[2] ^= 1;
+		Mount(image);
+		DIR dir;
+		FILINFO info;
+		info.lfname = nullptr;
+		info.lfsize = 0;
+		CHECK(f_opendir(&dir, "0:/sys") == FR_OK);
+		CHECK(f_readdir(&dir, &info) == FR_INT_ERR);
+	}
+}
+
+// Data past the valid data length is undefined, so reading stops there
+static void TestValidDataLength()
+{
+	const std::vector<uint8_t> contents = Contents(20000);
+	std::vector<uint8_t> image = MakeExFatImage(DirName, FileName, contents, 8, false);
+	uint8_t * const set = FindEntrySet(image);
+	CHECK(set != nullptr);
+	if (set != nullptr)
+	{
+		std::vector<uint8_t> data;
+		Put32(set + StreamValidDataLength, 12345);
+		SetChecksum(set);
+		CHECK(ReadFile(image, data) == FR_OK);
+		CHECK(data.size() == 12345 && memcmp(data.data(), contents.data(), data.size()) == 0);
+
+		FIL file;
+		CHECK(f_open(&file, FilePath, FA_OPEN_EXISTING | FA_READ) == FR_OK);
+		CHECK(file.fsize == 12345);
+		CHECK(f_lseek(&file, 15000) == FR_OK && file.fptr == 12345);
+
+		Put32(set + StreamValidDataLength, 20001);			// past the data length
+		SetChecksum(set);
+		CHECK(ReadFile(image, data) == FR_INT_ERR);
+	}
+}
+
+// A file of 4 GiB or more cannot be opened, and is left out of a listing
+static void TestHugeFile()
+{
+	std::vector<uint8_t> image = MakeExFatImage(DirName, FileName, Contents(20000), 8, false);
+	uint8_t * const set = FindEntrySet(image);
+	CHECK(set != nullptr);
+	if (set != nullptr)
+	{
+		std::vector<uint8_t> data;
+		Put32(set + StreamDataLength + 4, 1);
+		SetChecksum(set);
+		CHECK(ReadFile(image, data) == FR_DENIED);
+
+		DIR dir;
+		FILINFO info;
+		info.lfname = nullptr;
+		info.lfsize = 0;
+		CHECK(f_opendir(&dir, "0:/sys") == FR_OK);
+		CHECK(f_readdir(&dir, &info) == FR_OK && info.fname[0] == 0);
+	}
+}
+
+int main()
+{
+	TestReadFile();
+	TestSeek();
+	TestListing();
+	TestSetChecksum();
+	TestValidDataLength();
+	TestHugeFile();
+
+	if (failures != 0)
+	{
+		printf("ExFatTest: %u checks failed\n", failures);
+		return 1;
+	}
+	printf("ExFatTest: all checks passed\n");
+	return 0;
+}
+
+// End
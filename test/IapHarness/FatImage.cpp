@@ -0,0 +1,441 @@
+/*
+ * FatImage.cpp
+ *
+ * Builds FAT16 SD card images in memory for the IAP test harness.
+ */
+
+#include "FatImage.h"
+
+#include <cctype>
+#include <cstring>
+
+namespace
+{
+	const size_t SectorSize = 512;
+	const size_t DirEntrySize = 32;
+	const uint32_t RootEntries = 512;
+	const uint32_t MinFat16Clusters = 4200;				// FatFs treats a volume with fewer than 4086 clusters as FAT12
+	const uint32_t ReservedSectors = 1;
+	const uint32_t NumFats = 2;
+
+	const uint8_t AttrDirectory = 0x10;
+	const uint8_t AttrArchive = 0x20;
+	const uint8_t AttrLongName = 0x0F;
+
+	void Put16(uint8_t *p, uint16_t val)
+	{
+		p[0] = (uint8_t)val;
+		p[1] = (uint8_t)(val >> 8);
+	}
+
+	void Put32(uint8_t *p, uint32_t val)
+	{
+		Put16(p, (uint16_t)val);
+		Put16(p + 2, (uint16_t)(val >> 16));
+	}
+
+	// A name needs a long filename entry unless it is a valid upper case 8.3 name
+	bool NeedsLongName(const char *name)
+	{
+		const char * const dot = strrchr(name, '.');
+		const size_t baseLength = (dot != nullptr) ? (size_t)(dot - name) : strlen(name);
+		const size_t extLength = (dot != nullptr) ? strlen(dot + 1) : 0;
+		if (baseLength == 0 || baseLength > 8 || extLength > 3)
+		{
+			return true;
+		}
+		for (const char *p = name; *p != 0; ++p)
+		{
+			if (islower((unsigned char)*p) || *p == ' ' || (*p == '.' && p != dot))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Make the short name in directory entry format, with a numeric tail if there is also a long name
+	void MakeShortName(const char *name, bool numericTail, char sfn[11])
+	{
+		memset(sfn, ' ', 11);
+		const char * const dot = strrchr(name, '.');
+		const size_t maxBase = (numericTail) ? 6 : 8;
+		size_t n = 0;
+		for (const char *p = name; *p != 0 && p != dot && n < maxBase; ++p)
+		{
+			if (*p != ' ' && *p != '.')
+			{
+				sfn[n++] = (char)toupper((unsigned char)*p);
+			}
+		}
+		if (numericTail)
+		{
+			sfn[n++] = '~';
+			sfn[n] = '1';
+		}
+		if (dot != nullptr)
+		{
+			for (size_t i = 0; i < 3 && dot[i + 1] != 0; ++i)
+			{
+				sfn[8 + i] = (char)toupper((unsigned char)dot[i + 1]);
+			}
+		}
+	}
+
+	uint8_t ShortNameChecksum(const char sfn[11])
+	{
+		uint8_t sum = 0;
+		for (size_t i = 0; i < 11; ++i)
+		{
+			sum = (uint8_t)(((sum & 1) ? 0x80 : 0) + (sum >> 1) + (uint8_t)sfn[i]);
+		}
+		return sum;
+	}
+
+	void WriteShortEntry(uint8_t *entry, const char sfn[11], uint8_t attr, uint16_t cluster, uint32_t size)
+	{
+		memset(entry, 0, DirEntrySize);
+		memcpy(entry, sfn, 11);
+		entry[11] = attr;
+		Put16(entry + 22, 0x6000);						// 12:00:00
+		Put16(entry + 24, 0x5021);						// 2020-01-01
+		Put16(entry + 26, cluster);
+		Put32(entry + 28, size);
+	}
+
+	// Write the directory entries for a name, with long filename entries if it needs them, and return where the next entry goes
+	uint8_t *WriteEntry(uint8_t *entry, const char *name, uint8_t attr, uint16_t cluster, uint32_t size)
+	{
+		char sfn[11];
+		const bool longName = NeedsLongName(name);
+		MakeShortName(name, longName, sfn);
+		if (longName)
+		{
+			static const uint8_t charOffsets[13] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
+			const size_t length = strlen(name);
+			const size_t numLfnEntries = (length + 12) / 13;
+			const uint8_t checksum = ShortNameChecksum(sfn);
+
+			// The entry holding the end of the name comes first
+			for (size_t ord = numLfnEntries; ord != 0; --ord)
+			{
+				memset(entry, 0, DirEntrySize);
+				entry[0] = (uint8_t)(ord | ((ord == numLfnEntries) ? 0x40 : 0));
+				entry[11] = AttrLongName;
+				entry[13] = checksum;
+				for (size_t i = 0; i < 13; ++i)
+				{
+					const size_t index = (ord - 1) * 13 + i;
+					Put16(entry + charOffsets[i], (index < length) ? (uint8_t)name[index] : (index == length) ? 0 : 0xFFFF);
+				}
+				entry += DirEntrySize;
+			}
+		}
+		WriteShortEntry(entry, sfn, attr, cluster, size);
+		return entry + DirEntrySize;
+	}
+
+	// exFAT
+	const uint32_t ExFatBootRegionSectors = 12;				// the main boot region, followed by its backup
+	const uint32_t ExFatFatOffset = 2 * ExFatBootRegionSectors;
+	const uint32_t ExFatEndOfChain = 0xFFFFFFFF;
+	const uint32_t ExFatTimestamp = 0x50216000;				// 2020-01-01 12:00:00
+	const size_t ExFatNameCharsPerEntry = 15;
+
+	const uint8_t EntryBitmap = 0x81;
+	const uint8_t EntryUpcase = 0x82;
+	const uint8_t EntryFile = 0x85;
+	const uint8_t EntryStream = 0xC0;
+	const uint8_t EntryFileName = 0xC1;
+
+	const uint8_t FlagAllocationPossible = 0x01;
+	const uint8_t FlagNoFatChain = 0x02;
+
+	void Put64(uint8_t *p, uint64_t val)
+	{
+		Put32(p, (uint32_t)val);
+		Put32(p + 4, (uint32_t)(val >> 32));
+	}
+
+	// The boot region checksum leaves out the VolumeFlags and PercentInUse fields of the boot sector
+	uint32_t BootRegionChecksum(const uint8_t *region)
+	{
+		uint32_t sum = 0;
+		for (size_t i = 0; i < 11 * SectorSize; ++i)
+		{
+			if (i != 106 && i != 107 && i != 112)
+			{
+				sum = ((sum & 1) ? 0x80000000 : 0) + (sum >> 1) + region[i];
+			}
+		}
+		return sum;
+	}
+
+	// The name hash in the stream extension entry, over the up-cased name
+	uint16_t NameHash(const char *name)
+	{
+		uint16_t hash = 0;
+		for (const char *p = name; *p != 0; ++p)
+		{
+			const uint16_t c = (uint16_t)toupper((unsigned char)*p);
+			hash = (uint16_t)(((hash & 1) ? 0x8000 : 0) + (hash >> 1) + (c & 0xFF));
+			hash = (uint16_t)(((hash & 1) ? 0x8000 : 0) + (hash >> 1) + (c >> 8));
+		}
+		return hash;
+	}
+
+	// Write the entry set for a name: the file entry, the stream extension entry and the name entries
+	uint8_t *WriteEntrySet(uint8_t *entry, const char *name, uint8_t attr, uint8_t flags, uint32_t cluster, uint64_t size)
+	{
+		const size_t length = strlen(name);
+		const size_t numNameEntries = (length + ExFatNameCharsPerEntry - 1) / ExFatNameCharsPerEntry;
+		uint8_t * const set = entry;
+		memset(set, 0, (2 + numNameEntries) * DirEntrySize);
+
+		set[0] = EntryFile;
+		set[1] = (uint8_t)(1 + numNameEntries);
+		Put16(set + 4, attr);
+		Put32(set + 8, ExFatTimestamp);
+		Put32(set + 12, ExFatTimestamp);
+		Put32(set + 16, ExFatTimestamp);
+
+		uint8_t * const stream = set + DirEntrySize;
+		stream[0] = EntryStream;
+		stream[1] = flags;
+		stream[3] = (uint8_t)length;
+		Put16(stream + 4, NameHash(name));
+		Put64(stream + 8, size);							// valid data length
+		Put32(stream + 20, cluster);
+		Put64(stream + 24, size);							// data length
+
+		for (size_t i = 0; i < length; ++i)
+		{
+			uint8_t * const nameEntry = set + (2 + i / ExFatNameCharsPerEntry) * DirEntrySize;
+			nameEntry[0] = EntryFileName;
+			Put16(nameEntry + 2 + (i % ExFatNameCharsPerEntry) * 2, (uint8_t)name[i]);
+		}
+		Put16(set + 2, ExFatSetChecksum(set, 2 + numNameEntries));
+		return set + (2 + numNameEntries) * DirEntrySize;
+	}
+}
+
+std::vector<uint8_t> MakeFat16Image(const char *dirName, const char *fileName, const std::vector<uint8_t>& contents,
+									unsigned int sectorsPerCluster, bool fragmented, bool trimmed)
+{
+	const size_t clusterSize = SectorSize * sectorsPerCluster;
+	const uint32_t fileClusters = (uint32_t)((contents.size() + clusterSize - 1) / clusterSize);
+	const uint32_t clusterStride = (fragmented) ? 2 : 1;
+	uint32_t numClusters = 1 + fileClusters * clusterStride + 16;
+	if (numClusters < MinFat16Clusters)
+	{
+		numClusters = MinFat16Clusters;
+	}
+	const uint32_t fatSectors = (uint32_t)(((numClusters + 2) * 2 + SectorSize - 1) / SectorSize);
+	const uint32_t rootSectors = (uint32_t)(RootEntries * DirEntrySize / SectorSize);
+	const uint32_t firstDataSector = ReservedSectors + NumFats * fatSectors + rootSectors;
+	const uint32_t totalSectors = firstDataSector + numClusters * sectorsPerCluster;
+
+	const uint32_t lastCluster = (fileClusters != 0) ? 3 + (fileClusters - 1) * clusterStride : 2;
+	const uint32_t imageSectors = (trimmed) ? firstDataSector + (lastCluster - 1) * sectorsPerCluster : totalSectors;
+	std::vector<uint8_t> image((size_t)imageSectors * SectorSize, 0);
+	auto clusterData = [&](uint32_t cluster) { return image.data() + ((size_t)firstDataSector + (size_t)(cluster - 2) * sectorsPerCluster) * SectorSize; };
+
+	// Boot sector with the BIOS parameter block
+	uint8_t * const bs = image.data();
+	bs[0] = 0xEB;
+	bs[1] = 0x3C;
+	bs[2] = 0x90;
+	memcpy(bs + 3, "MSDOS5.0", 8);
+	Put16(bs + 11, SectorSize);
+	bs[13] = (uint8_t)sectorsPerCluster;
+	Put16(bs + 14, ReservedSectors);
+	bs[16] = NumFats;
+	Put16(bs + 17, RootEntries);
+	Put16(bs + 19, (totalSectors < 0x10000) ? totalSectors : 0);
+	bs[21] = 0xF8;										// fixed disk
+	Put16(bs + 22, fatSectors);
+	Put16(bs + 24, 63);
+	Put16(bs + 26, 255);
+	Put32(bs + 32, (totalSectors < 0x10000) ? 0 : totalSectors);
+	bs[36] = 0x80;
+	bs[38] = 0x29;
+	Put32(bs + 39, 0x20200101);
+	memcpy(bs + 43, "NO NAME    ", 11);
+	memcpy(bs + 54, "FAT16   ", 8);
+	bs[510] = 0x55;
+	bs[511] = 0xAA;
+
+	// Cluster 2 holds the subdirectory, and the file starts at cluster 3
+	std::vector<uint16_t> fat(numClusters + 2, 0);
+	fat[0] = 0xFFF8;
+	fat[1] = 0xFFFF;
+	const uint32_t dirCluster = 2;
+	fat[dirCluster] = 0xFFFF;
+	const uint32_t firstFileCluster = (fileClusters != 0) ? 3 : 0;
+	uint32_t cluster = firstFileCluster;
+	for (uint32_t i = 0; i < fileClusters; ++i)
+	{
+		const uint32_t next = cluster + clusterStride;
+		fat[cluster] = (uint16_t)((i + 1 == fileClusters) ? 0xFFFF : next);
+		const size_t offset = (size_t)i * clusterSize;
+		memcpy(clusterData(cluster), contents.data() + offset, (contents.size() - offset < clusterSize) ? contents.size() - offset : clusterSize);
+		cluster = next;
+	}
+	for (uint32_t f = 0; f < NumFats; ++f)
+	{
+		uint8_t * const fatStart = image.data() + (size_t)(ReservedSectors + f * fatSectors) * SectorSize;
+		for (size_t i = 0; i < fat.size(); ++i)
+		{
+			Put16(fatStart + i * 2, fat[i]);
+		}
+	}
+
+	uint8_t * const root = image.data() + (size_t)(ReservedSectors + NumFats * fatSectors) * SectorSize;
+	WriteEntry(root, dirName, AttrDirectory, dirCluster, 0);
+
+	uint8_t *entry = clusterData(dirCluster);
+	WriteShortEntry(entry, ".          ", AttrDirectory, dirCluster, 0);
+	WriteShortEntry(entry + DirEntrySize, "..         ", AttrDirectory, 0, 0);
+	WriteEntry(entry + 2 * DirEntrySize, fileName, AttrArchive, (uint16_t)firstFileCluster, (uint32_t)contents.size());
+	return image;
+}
+
+uint16_t ExFatSetChecksum(const uint8_t *entries, size_t numEntries)
+{
+	uint16_t sum = 0;
+	for (size_t i = 0; i < numEntries * DirEntrySize; ++i)
+	{
+		if (i != 2 && i != 3)								// the checksum itself
+		{
+			sum = (uint16_t)(((sum & 1) ? 0x8000 : 0) + (sum >> 1) + entries[i]);
+		}
+	}
+	return sum;
+}
+
+std::vector<uint8_t> MakeExFatImage(const char *dirName, const char *fileName, const std::vector<uint8_t>& contents,
+									unsigned int sectorsPerCluster, bool fragmented)
+{
+	const size_t clusterSize = SectorSize * sectorsPerCluster;
+	const uint32_t fileClusters = (uint32_t)((contents.size() + clusterSize - 1) / clusterSize);
+	const uint32_t clusterStride = (fragmented) ? 2 : 1;
+
+	// The allocation bitmap comes first, then the up-case table, the root directory, the subdirectory and the file.
+	// The bitmap has a bit for each cluster, its own included.
+	const uint32_t dataClusters = fileClusters * clusterStride + 16;
+	uint32_t bitmapClusters = 1;
+	while ((size_t)bitmapClusters * clusterSize * 8 < bitmapClusters + 3 + dataClusters)
+	{
+		++bitmapClusters;
+	}
+	const uint32_t totalClusters = bitmapClusters + 3 + dataClusters;
+	const uint32_t bitmapBytes = (totalClusters + 7) / 8;
+	const uint32_t bitmapCluster = 2;
+	const uint32_t upcaseCluster = bitmapCluster + bitmapClusters;
+	const uint32_t rootCluster = upcaseCluster + 1;
+	const uint32_t dirCluster = rootCluster + 1;
+	const uint32_t firstFileCluster = (fileClusters != 0) ? dirCluster + 1 : 0;
+
+	const uint32_t fatSectors = (uint32_t)(((totalClusters + 2) * 4 + SectorSize - 1) / SectorSize);
+	const uint32_t heapOffset = ExFatFatOffset + fatSectors;
+	const uint32_t totalSectors = heapOffset + totalClusters * sectorsPerCluster;
+	std::vector<uint8_t> image((size_t)totalSectors * SectorSize, 0);
+	auto clusterData = [&](uint32_t cluster) { return image.data() + ((size_t)heapOffset + (size_t)(cluster - 2) * sectorsPerCluster) * SectorSize; };
+
+	// Main boot region: the boot sector, 8 extended boot sectors, the OEM parameters, a reserved sector and the checksums
+	uint8_t * const bs = image.data();
+	bs[0] = 0xEB;
+	bs[1] = 0x76;
+	bs[2] = 0x90;
+	memcpy(bs + 3, "EXFAT   ", 8);
+	Put64(bs + 72, totalSectors);
+	Put32(bs + 80, ExFatFatOffset);
+	Put32(bs + 84, fatSectors);
+	Put32(bs + 88, heapOffset);
+	Put32(bs + 92, totalClusters);
+	Put32(bs + 96, rootCluster);
+	Put32(bs + 100, 0x20200101);						// volume serial number
+	Put16(bs + 104, 0x0100);							// revision 1.00
+	bs[108] = 9;										// log2 of 512 byte sectors
+	for (unsigned int n = sectorsPerCluster; n > 1; n >>= 1)
+	{
+		++bs[109];
+	}
+	bs[110] = 1;										// one FAT
+	bs[111] = 0x80;
+	bs[510] = 0x55;
+	bs[511] = 0xAA;
+	for (size_t sector = 1; sector <= 8; ++sector)			// extended boot sectors
+	{
+		bs[sector * SectorSize + 510] = 0x55;
+		bs[sector * SectorSize + 511] = 0xAA;
+	}
+	const uint32_t bootChecksum = BootRegionChecksum(bs);
+	for (size_t i = 0; i < SectorSize; i += 4)
+	{
+		Put32(bs + 11 * SectorSize + i, bootChecksum);
+	}
+	memcpy(bs + ExFatBootRegionSectors * SectorSize, bs, ExFatBootRegionSectors * SectorSize);
+
+	// FAT and allocation bitmap. A contiguous file needs no FAT entries, and leaving them free shows that FatFs never reads them.
+	std::vector<uint32_t> fat(totalClusters + 2, 0);
+	fat[0] = 0xFFFFFFF8;
+	fat[1] = ExFatEndOfChain;
+	std::vector<uint8_t> bitmap(bitmapBytes, 0);
+	auto allocate = [&](uint32_t cluster, uint32_t next)
+	{
+		fat[cluster] = next;
+		bitmap[(cluster - 2) / 8] |= (uint8_t)(1u << ((cluster - 2) % 8));
+	};
+	for (uint32_t c = bitmapCluster; c < upcaseCluster; ++c)
+	{
+		allocate(c, (c + 1 == upcaseCluster) ? ExFatEndOfChain : c + 1);
+	}
+	allocate(upcaseCluster, ExFatEndOfChain);
+	allocate(rootCluster, ExFatEndOfChain);
+	allocate(dirCluster, 0);
+	uint32_t cluster = firstFileCluster;
+	for (uint32_t i = 0; i < fileClusters; ++i)
+	{
+		const uint32_t next = cluster + clusterStride;
+		allocate(cluster, (!fragmented) ? 0 : (i + 1 == fileClusters) ? ExFatEndOfChain : next);
+		const size_t offset = (size_t)i * clusterSize;
+		memcpy(clusterData(cluster), contents.data() + offset, (contents.size() - offset < clusterSize) ? contents.size() - offset : clusterSize);
+		cluster = next;
+	}
+	uint8_t * const fatStart = image.data() + (size_t)ExFatFatOffset * SectorSize;
+	for (size_t i = 0; i < fat.size(); ++i)
+	{
+		Put32(fatStart + i * 4, fat[i]);
+	}
+	memcpy(clusterData(bitmapCluster), bitmap.data(), bitmap.size());
+
+	// An up-case table that only covers ASCII, which the specification allows
+	uint8_t * const upcase = clusterData(upcaseCluster);
+	const size_t upcaseBytes = 128 * 2;
+	uint32_t upcaseChecksum = 0;
+	for (size_t i = 0; i < upcaseBytes / 2; ++i)
+	{
+		Put16(upcase + i * 2, (uint16_t)toupper((int)i));
+	}
+	for (size_t i = 0; i < upcaseBytes; ++i)
+	{
+		upcaseChecksum = ((upcaseChecksum & 1) ? 0x80000000 : 0) + (upcaseChecksum >> 1) + upcase[i];
+	}
+
+	uint8_t * const root = clusterData(rootCluster);
+	root[0] = EntryBitmap;
+	Put32(root + 20, bitmapCluster);
+	Put64(root + 24, bitmapBytes);
+	root[DirEntrySize] = EntryUpcase;
+	Put32(root + DirEntrySize + 4, upcaseChecksum);
+	Put32(root + DirEntrySize + 20, upcaseCluster);
+	Put64(root + DirEntrySize + 24, upcaseBytes);
+	WriteEntrySet(root + 2 * DirEntrySize, dirName, AttrDirectory, FlagAllocationPossible | FlagNoFatChain, dirCluster, clusterSize);
+
+	const uint8_t fileFlags = (fileClusters == 0) ? 0 : (fragmented) ? FlagAllocationPossible : FlagAllocationPossible | FlagNoFatChain;
+	WriteEntrySet(clusterData(dirCluster), fileName, AttrArchive, fileFlags, firstFileCluster, contents.size());
+	return image;
+}
+
+// End
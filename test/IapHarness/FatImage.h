@@ -0,0 +1,29 @@
+/*
+ * FatImage.h
+ *
+ * Builds FAT16 and exFAT SD card images in memory for the IAP test harness.
+ */
+
+#ifndef TEST_IAPHARNESS_FATIMAGE_H_
+#define TEST_IAPHARNESS_FATIMAGE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Build a FAT16 volume with one file in a subdirectory of the root. The file gets a long filename entry as well as its short name.
+// If fragmented is set, every other cluster of the file is left free, so that FatFs cannot read across cluster boundaries.
+// If trimmed is set, the image ends after the last cluster of the file, although the volume is still the full size.
+// FatFs never reads the free clusters past that point, so this saves memory when the image must fit in a small board.
+std::vector<uint8_t> MakeFat16Image(const char *dirName, const char *fileName, const std::vector<uint8_t>& contents,
+									unsigned int sectorsPerCluster, bool fragmented, bool trimmed = false);
+
+// Build an exFAT image in the same way. The file is flagged as contiguous (NoFatChain) and has no FAT chain,
+// unless it is fragmented, when it is FAT chained with a free cluster after each of its clusters.
+std::vector<uint8_t> MakeExFatImage(const char *dirName, const char *fileName, const std::vector<uint8_t>& contents,
+									unsigned int sectorsPerCluster, bool fragmented);
+
+// The checksum of an exFAT directory entry set, which the first entry of the set holds
+uint16_t ExFatSetChecksum(const uint8_t *entries, size_t numEntries);
+
+#endif /* TEST_IAPHARNESS_FATIMAGE_H_ */
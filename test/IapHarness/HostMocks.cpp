@@ -0,0 +1,642 @@
+/*
+ * HostMocks.cpp
+ *
+ * Mocked hardware for running the IAP on the build host. See HostMocks.h.
+ *
+ * The flash of the SAM4E and its RAM are mapped at their real addresses, because the IAP reads the flash directly
+ * and finds its parameters through the vector table. The harness is linked so that its own code and data lie below 4GB too,
+ * which keeps the 32-bit addresses that the IAP gives to the DMA controller valid.
+ */
+
+#include "HostMocks.h"
+#include "iap.h"
+#include "flash_efc.h"
+
+#ifdef IAP_VIA_SPI
+# include <dmac/dmac.h>
+#else
+extern "C"
+{
+# include "diskio.h"
+}
+# include "ff.h"
+# include "Libraries/sd_mmc/sd_mmc.h"
+#endif
+
+#include <cstdio>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// IAP state that the mocks look at
+extern uint32_t flashPos;
+extern ProcessState state;
+extern uint32_t totalRetries;
+#ifdef IAP_VIA_SPI
+extern uint32_t numReflashes;
+extern "C" void SPI_Handler(void) noexcept;
+#endif
+extern "C" void AppMain() noexcept;
+
+HostConfig hostConfig;
+HostResult *hostResult;
+
+HostScb hostScb;
+HostSpi hostSpi;
+HostDmac hostDmac;
+HostSerial Serial;
+
+const char * const hostFaultNames[NumHostFaults] = { "sd-read", "short-read", "erase", "not-erased", "program", "verify", "lock", "sbc-data" };
+
+namespace
+{
+	uint8_t * const flash = reinterpret_cast<uint8_t *>(IFLASH_ADDR);
+	const uint32_t NumLockRegions = IFLASH_SIZE / IFLASH_LOCK_REGION_SIZE;
+
+	uint64_t hostMicros = 0;
+	uint32_t randomState = 1;
+	bool regionLocked[NumLockRegions];
+	bool gpnvmCleared = false;
+
+	char messageLine[256];
+	size_t messageLength = 0;
+
+	uint32_t NextRandom() noexcept
+	{
+		// xorshift32
+		randomState ^= randomState << 13;
+		randomState ^= randomState >> 17;
+		randomState ^= randomState << 5;
+		return randomState;
+	}
+
+	// Decide whether to make the current attempt at an operation fail. The caller records the fault if it has any effect.
+	bool FaultDue(HostFault fault) noexcept
+	{
+		const HostFaultSetting& setting = hostConfig.faults[fault];
+		if (setting.rate <= 0.0 || flashPos < setting.start || flashPos >= setting.end)
+		{
+			return false;
+		}
+		return (NextRandom() >> 8) * (1.0 / 16777216.0) < setting.rate;
+	}
+
+	bool InjectFault(HostFault fault) noexcept
+	{
+		if (FaultDue(fault))
+		{
+			++hostResult->faultsInjected[fault];
+			return true;
+		}
+		return false;
+	}
+
+	[[noreturn]] void Finish(bool timedOut) noexcept
+	{
+		HostResult& r = *hostResult;
+		r.finished = !timedOut;
+		r.timedOut = timedOut;
+		r.micros = hostMicros;
+		r.retries = totalRetries;
+#ifdef IAP_VIA_SPI
+		r.reflashes = numReflashes;
+#endif
+		r.bootloaderSelected = gpnvmCleared;
+#ifdef IAP_MINIMAL
+		r.reportedSuccess = (strcmp(r.lastMessage, "#5a561248") == 0);		// the token of "Update successful! Rebooting..."
+#else
+		r.reportedSuccess = (strcmp(r.lastMessage, "Update successful! Rebooting...") == 0);
+#endif
+		r.flashMatches = (memcmp(flash + (FirmwareFlashStart - IFLASH_ADDR), hostConfig.expectedFlash, FirmwareFlashEnd - FirmwareFlashStart) == 0);
+		fflush(stdout);
+		_exit(0);
+	}
+
+	bool IsInFlash(uint32_t addr, uint32_t length) noexcept
+	{
+		return addr >= IFLASH_ADDR && addr - IFLASH_ADDR <= IFLASH_SIZE && length <= IFLASH_SIZE - (addr - IFLASH_ADDR);
+	}
+
+	bool IsLocked(uint32_t addr, uint32_t length) noexcept
+	{
+		for (uint32_t region = (addr - IFLASH_ADDR) / IFLASH_LOCK_REGION_SIZE; region <= (addr + length - 1 - IFLASH_ADDR) / IFLASH_LOCK_REGION_SIZE; ++region)
+		{
+			if (regionLocked[region])
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Lock or unlock the regions that contain start..end inclusive
+	uint32_t SetLockBits(uint32_t start, uint32_t end, bool lock, uint32_t *actualStart, uint32_t *actualEnd) noexcept
+	{
+		hostMicros += hostConfig.costs.lockMicros;
+		if (end < start || !IsInFlash(start, 1))
+		{
+			return FLASH_RC_INVALID;
+		}
+		if (InjectFault(HostFaultLock))
+		{
+			return FLASH_RC_ERROR;
+		}
+		if (end >= IFLASH_ADDR + IFLASH_SIZE)
+		{
+			end = IFLASH_ADDR + IFLASH_SIZE - 1;
+		}
+		const uint32_t first = (start - IFLASH_ADDR) / IFLASH_LOCK_REGION_SIZE;
+		const uint32_t last = (end - IFLASH_ADDR) / IFLASH_LOCK_REGION_SIZE;
+		for (uint32_t region = first; region <= last; ++region)
+		{
+			regionLocked[region] = lock;
+		}
+		if (actualStart != nullptr)
+		{
+			*actualStart = IFLASH_ADDR + first * IFLASH_LOCK_REGION_SIZE;
+		}
+		if (actualEnd != nullptr)
+		{
+			*actualEnd = IFLASH_ADDR + (last + 1) * IFLASH_LOCK_REGION_SIZE - 1;
+		}
+		return FLASH_RC_OK;
+	}
+
+	// The SAM4E has two 8K sectors, then one 48K sector, then 64K sectors
+	uint32_t SectorStart(uint32_t addr) noexcept
+	{
+		const uint32_t offset = addr - IFLASH_ADDR;
+		return IFLASH_ADDR + ((offset < 16 * 1024) ? offset & ~(8 * 1024 - 1)
+								: (offset < 64 * 1024) ? 16 * 1024
+									: offset & ~(64 * 1024 - 1));
+	}
+
+	uint32_t SectorSize(uint32_t addr) noexcept
+	{
+		const uint32_t offset = addr - IFLASH_ADDR;
+		return (offset < 16 * 1024) ? 8 * 1024 : (offset < 64 * 1024) ? 48 * 1024 : 64 * 1024;
+	}
+
+#ifdef IAP_VIA_SPI
+
+	// Model of the SBC side of the update, as done by DuetControlServer
+	enum class SbcPhase
+	{
+		sendingFirmware,
+		waitingBeforeVerify,
+		sendingVerifyRequest,
+		receivingResult,
+		done
+	};
+
+	SbcPhase sbcPhase = SbcPhase::sendingFirmware;
+	size_t sbcBlock = 0;
+	bool sbcEdgePending = false;			// the IAP has toggled the transfer ready pin and we haven't responded yet
+	uint64_t sbcEdgeMicros;
+	uint64_t sbcWaitUntil;
+	bool spiEnabled = false;
+	uint32_t dmaSourceAddr[8], dmaDestAddr[8];
+	uint8_t sbcReceivedByte;
+
+	uint16_t Crc16(const uint8_t *data, size_t length) noexcept
+	{
+		uint16_t crc = 65535;
+		for (size_t i = 0; i < length; ++i)
+		{
+			crc ^= data[i];
+			for (int bit = 0; bit < 8; ++bit)
+			{
+				crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+			}
+		}
+		return crc;
+	}
+
+	// Do one SPI transfer and raise the end of transfer interrupt
+	void SbcTransfer(const void *data, size_t length) noexcept
+	{
+		hostMicros += (uint64_t)length * hostConfig.costs.spiByteNanos / 1000;
+		memcpy(reinterpret_cast<void *>((uintptr_t)dmaDestAddr[DmacChanSbcRx]), data, length);
+		sbcReceivedByte = *reinterpret_cast<const uint8_t *>((uintptr_t)dmaSourceAddr[DmacChanSbcTx]);
+		hostDmac.DMAC_CHSR &= ~((DMAC_CHSR_ENA0 << DmacChanSbcRx) | (DMAC_CHSR_ENA0 << DmacChanSbcTx));
+		sbcEdgePending = false;
+		hostSpi.SPI_SR |= SPI_SR_NSSR;
+		SPI_Handler();
+		hostSpi.SPI_SR = 0;
+	}
+
+	// Respond to the transfer ready signal once the SBC has had time to notice it
+	void SbcPoll() noexcept
+	{
+		if (   !sbcEdgePending
+			|| !spiEnabled
+			|| (hostDmac.DMAC_CHSR & (DMAC_CHSR_ENA0 << DmacChanSbcRx)) == 0
+			|| hostMicros < sbcEdgeMicros + hostConfig.costs.sbcLatencyMicros
+		   )
+		{
+			return;
+		}
+
+		switch (sbcPhase)
+		{
+		case SbcPhase::sendingFirmware:
+			{
+				const size_t offset = sbcBlock * blockReadSize;
+				if (offset >= hostConfig.sbcImageSize)
+				{
+					// DCS waits a while after the last block, so that the IAP can tell that the firmware is complete
+					sbcPhase = SbcPhase::waitingBeforeVerify;
+					sbcWaitUntil = hostMicros + (uint64_t)hostConfig.sbcWaitMillis * 1000;
+					return;
+				}
+				uint8_t block[blockReadSize];
+				const size_t length = (hostConfig.sbcImageSize - offset < blockReadSize) ? hostConfig.sbcImageSize - offset : blockReadSize;
+				memset(block, 0xFF, blockReadSize);
+				memcpy(block, hostConfig.sbcImage + offset, length);
+				if (InjectFault(HostFaultSbcData))
+				{
+					block[NextRandom() % length] ^= 0x5A;
+				}
+				++sbcBlock;
+				SbcTransfer(block, blockReadSize);
+			}
+			break;
+
+		case SbcPhase::waitingBeforeVerify:
+			if (hostMicros < sbcWaitUntil)
+			{
+				return;
+			}
+			sbcPhase = SbcPhase::sendingVerifyRequest;
+			// no break
+		case SbcPhase::sendingVerifyRequest:
+			{
+				const FlashVerifyRequest request = { (uint32_t)hostConfig.sbcImageSize, Crc16(hostConfig.sbcImage, hostConfig.sbcImageSize), 0 };
+				sbcPhase = SbcPhase::receivingResult;
+				SbcTransfer(&request, sizeof(request));
+			}
+			break;
+
+		case SbcPhase::receivingResult:
+			{
+				const uint8_t dummy = 0;
+				SbcTransfer(&dummy, sizeof(dummy));
+				if (sbcReceivedByte == 0x0C)
+				{
+					sbcPhase = SbcPhase::done;
+				}
+				else
+				{
+					// The IAP reported a CRC error, so send the whole firmware again
+					sbcBlock = 0;
+					sbcPhase = SbcPhase::sendingFirmware;
+				}
+			}
+			break;
+
+		case SbcPhase::done:
+			break;
+		}
+	}
+
+#else
+
+	uint64_t cardStartMicros;
+
+#endif
+}
+
+// Set up the mocked flash and RAM and run the IAP
+[[noreturn]] void HostRunIap() noexcept
+{
+	if (   mmap(flash, IFLASH_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0) != flash
+		|| mmap(reinterpret_cast<void *>(IRAM_ADDR), IRAM_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0) != reinterpret_cast<void *>(IRAM_ADDR)
+	   )
+	{
+		perror("IapHarness: cannot map the flash and RAM of the target");
+		_exit(2);
+	}
+
+	// The main firmware leaves its flash locked
+	memcpy(flash, hostConfig.flashContents, IFLASH_SIZE);
+	for (bool& locked : regionLocked)
+	{
+		locked = true;
+	}
+
+	// RepRapFirmware stores the firmware filename and the verification level just above the initial stack pointer
+	const uint32_t stackTop = IRAM_ADDR + IRAM_SIZE - 1024;
+	*reinterpret_cast<uint32_t *>(IRAM_ADDR) = stackTop;
+	memcpy(reinterpret_cast<void *>(stackTop), hostConfig.ramParameters, hostConfig.ramParametersLength);
+	hostScb.VTOR = IRAM_ADDR;
+
+	randomState = (hostConfig.seed != 0) ? hostConfig.seed : 1;
+	AppMain();
+	Finish(true);
+}
+
+// Core functions
+
+extern "C" uint32_t millis(void) noexcept
+{
+	hostMicros += hostConfig.costs.loopMicros;
+	if (hostMicros > hostConfig.timeLimitMicros)
+	{
+		Finish(true);
+	}
+#ifdef IAP_VIA_SPI
+	SbcPoll();
+#endif
+	return (uint32_t)(hostMicros / 1000);
+}
+
+extern "C" void digitalWrite(Pin pin, bool high) noexcept
+{
+#ifdef IAP_VIA_SPI
+	if (pin == SbcTfrReadyPin)
+	{
+		sbcEdgePending = true;
+		sbcEdgeMicros = hostMicros;
+	}
+#endif
+	(void)pin;
+	(void)high;
+}
+
+extern "C" void Reset(void) noexcept
+{
+	Finish(false);
+}
+
+void HostSerial::begin(uint32_t baudRate) noexcept
+{
+	(void)baudRate;
+}
+
+// Collect the JSON messages for PanelDue and record the last one
+void HostSerial::print(const char *str) noexcept
+{
+	static const char prefix[] = "{\"message\":\"";
+	static const char suffix[] = "\"}";
+	for (; *str != 0; ++str)
+	{
+		if (*str != '\n')
+		{
+			if (messageLength + 1 < sizeof(messageLine))
+			{
+				messageLine[messageLength++] = *str;
+			}
+			continue;
+		}
+
+		messageLine[messageLength] = 0;
+		const char *message = messageLine;
+		if (strncmp(message, prefix, sizeof(prefix) - 1) == 0)
+		{
+			message += sizeof(prefix) - 1;
+		}
+		size_t length = strlen(message);
+		if (length >= sizeof(suffix) - 1 && strcmp(message + length - (sizeof(suffix) - 1), suffix) == 0)
+		{
+			length -= sizeof(suffix) - 1;
+		}
+		if (length >= sizeof(hostResult->lastMessage))
+		{
+			length = sizeof(hostResult->lastMessage) - 1;
+		}
+		memcpy(hostResult->lastMessage, message, length);
+		hostResult->lastMessage[length] = 0;
+		if (hostResult->firstError[0] == 0 && strncmp(hostResult->lastMessage, "ERROR:", 6) == 0)
+		{
+			strcpy(hostResult->firstError, hostResult->lastMessage);
+		}
+		if (hostConfig.verbose)
+		{
+			printf("%10.3f  %s\n", hostMicros / 1000000.0, hostResult->lastMessage);
+		}
+		messageLength = 0;
+	}
+}
+
+// Flash controller
+
+extern "C" uint32_t flash_unlock(uint32_t ul_start, uint32_t ul_end, uint32_t *pul_actual_start, uint32_t *pul_actual_end) noexcept
+{
+	return SetLockBits(ul_start, ul_end, false, pul_actual_start, pul_actual_end);
+}
+
+extern "C" uint32_t flash_lock(uint32_t ul_start, uint32_t ul_end, uint32_t *pul_actual_start, uint32_t *pul_actual_end) noexcept
+{
+	return SetLockBits(ul_start, ul_end, true, pul_actual_start, pul_actual_end);
+}
+
+extern "C" uint32_t flash_erase_sector(uint32_t ul_address) noexcept
+{
+	if (!IsInFlash(ul_address, 1))
+	{
+		return FLASH_RC_INVALID;
+	}
+	const uint32_t start = SectorStart(ul_address);
+	const uint32_t size = SectorSize(ul_address);
+	hostMicros += (uint64_t)hostConfig.costs.eraseMicrosPerKb * (size / 1024);
+	if (IsLocked(start, size) || InjectFault(HostFaultErase))
+	{
+		return FLASH_RC_ERROR;
+	}
+	memset(flash + (start - IFLASH_ADDR), 0xFF, size);
+	if (InjectFault(HostFaultNotErased))
+	{
+		const uint32_t word = NextRandom() % (size / sizeof(uint32_t));
+		memset(flash + (start - IFLASH_ADDR) + word * sizeof(uint32_t), 0, sizeof(uint32_t));
+	}
+	return FLASH_RC_OK;
+}
+
+// Program the flash. Programming can only clear bits, so the data is ANDed with what the flash holds already.
+extern "C" uint32_t flash_write(uint32_t ul_address, const void *p_buffer, uint32_t ul_size, uint32_t ul_erase_flag) noexcept
+{
+	if (ul_size == 0 || !IsInFlash(ul_address, ul_size))
+	{
+		return FLASH_RC_INVALID;
+	}
+	const uint32_t firstPage = ul_address & ~(IFLASH_PAGE_SIZE - 1);
+	const uint32_t numPages = (ul_address + ul_size - firstPage + IFLASH_PAGE_SIZE - 1) / IFLASH_PAGE_SIZE;
+	hostMicros += (uint64_t)hostConfig.costs.pageWriteMicros * numPages;
+	if (IsLocked(firstPage, numPages * IFLASH_PAGE_SIZE) || InjectFault(HostFaultProgram))
+	{
+		return FLASH_RC_ERROR;
+	}
+	if (ul_erase_flag != 0)
+	{
+		memset(flash + (firstPage - IFLASH_ADDR), 0xFF, numPages * IFLASH_PAGE_SIZE);
+	}
+
+	uint8_t * const dest = flash + (ul_address - IFLASH_ADDR);
+	const uint8_t * const src = static_cast<const uint8_t *>(p_buffer);
+	size_t unprogrammed = ul_size;
+	if (FaultDue(HostFaultVerify))
+	{
+		// Leave one byte that should have changed unprogrammed
+		const size_t first = NextRandom() % ul_size;
+		for (size_t i = 0; i < ul_size; ++i)
+		{
+			const size_t j = (first + i) % ul_size;
+			if ((dest[j] & src[j]) != dest[j])
+			{
+				unprogrammed = j;
+				++hostResult->faultsInjected[HostFaultVerify];
+				break;
+			}
+		}
+	}
+	for (size_t i = 0; i < ul_size; ++i)
+	{
+		if (i != unprogrammed)
+		{
+			dest[i] &= src[i];
+		}
+	}
+	return FLASH_RC_OK;
+}
+
+extern "C" uint32_t flash_clear_gpnvm(uint32_t ul_gpnvm) noexcept
+{
+	if (ul_gpnvm == 1)
+	{
+		gpnvmCleared = true;					// boot from the ROM bootloader next time
+	}
+	return FLASH_RC_OK;
+}
+
+#ifdef IAP_VIA_SPI
+
+// SPI and DMA controller
+
+extern "C" void spi_enable(HostSpi *spi) noexcept
+{
+	(void)spi;
+	spiEnabled = true;
+}
+
+extern "C" void spi_disable(HostSpi *spi) noexcept
+{
+	(void)spi;
+	spiEnabled = false;
+}
+
+extern "C" void dmac_channel_enable(HostDmac *dmac, uint32_t channel) noexcept
+{
+	dmac->DMAC_CHSR |= DMAC_CHSR_ENA0 << channel;
+}
+
+extern "C" void dmac_channel_disable(HostDmac *dmac, uint32_t channel) noexcept
+{
+	dmac->DMAC_CHSR &= ~(DMAC_CHSR_ENA0 << channel);
+}
+
+extern "C" void dmac_channel_set_source_addr(HostDmac *dmac, uint32_t channel, uint32_t addr) noexcept
+{
+	(void)dmac;
+	dmaSourceAddr[channel] = addr;
+}
+
+extern "C" void dmac_channel_set_destination_addr(HostDmac *dmac, uint32_t channel, uint32_t addr) noexcept
+{
+	(void)dmac;
+	dmaDestAddr[channel] = addr;
+}
+
+#else
+
+// SD card, at the level of the FatFs disk interface
+
+extern "C" void sd_mmc_init(const Pin wpPins[], const Pin spiCsPins[]) noexcept
+{
+	(void)wpPins;
+	(void)spiCsPins;
+	cardStartMicros = hostMicros;
+}
+
+extern "C" sd_mmc_err_t sd_mmc_check(uint8_t slot) noexcept
+{
+	if (slot != 0)
+	{
+		return SD_MMC_ERR_SLOT;
+	}
+	return (hostMicros - cardStartMicros >= (uint64_t)hostConfig.cardInitMillis * 1000) ? SD_MMC_OK : SD_MMC_INIT_ONGOING;
+}
+
+extern "C" DSTATUS disk_initialize(BYTE drv)
+{
+	return (drv == 0) ? 0 : STA_NOINIT;
+}
+
+extern "C" DSTATUS disk_status(BYTE drv)
+{
+	return (drv == 0) ? 0 : STA_NOINIT;
+}
+
+extern "C" DRESULT disk_read(BYTE drv, BYTE *buff, DWORD sector, BYTE count)
+{
+	if (drv != 0 || sector + count > hostConfig.diskSectors)
+	{
+		return RES_PARERR;
+	}
+	hostMicros += hostConfig.costs.sdCommandMicros + (uint64_t)hostConfig.costs.sdSectorMicros * count;
+	if (InjectFault(HostFaultSdRead))
+	{
+		return RES_ERROR;
+	}
+	memcpy(buff, hostConfig.disk + (size_t)sector * 512, (size_t)count * 512);
+	return RES_OK;
+}
+
+// The harness is linked with --wrap=f_read, so the IAP's calls to f_read() come here. A short read asks FatFs for half as many bytes.
+// Only the reads of firmware data are cut short, because those are the ones the IAP retries.
+extern "C" FRESULT __real_f_read(FIL *fp, void *buff, UINT btr, UINT *br);
+
+extern "C" FRESULT __wrap_f_read(FIL *fp, void *buff, UINT btr, UINT *br)
+{
+	if (state == WritingUpgrade && btr > 1 && fp->fptr < fp->fsize && InjectFault(HostFaultShortRead))
+	{
+		btr /= 2;
+	}
+	return __real_f_read(fp, buff, btr, br);
+}
+
+extern "C" DRESULT disk_write(BYTE drv, const BYTE *buff, DWORD sector, BYTE count)
+{
+	(void)drv;
+	(void)buff;
+	(void)sector;
+	(void)count;
+	return RES_WRPRT;
+}
+
+extern "C" DRESULT disk_ioctl(BYTE drv, BYTE ctrl, void *buff)
+{
+	if (drv != 0)
+	{
+		return RES_PARERR;
+	}
+	switch (ctrl)
+	{
+	case CTRL_SYNC:
+		return RES_OK;
+
+	case GET_SECTOR_SIZE:
+		*static_cast<WORD *>(buff) = 512;
+		return RES_OK;
+
+	case GET_SECTOR_COUNT:
+		*static_cast<DWORD *>(buff) = hostConfig.diskSectors;
+		return RES_OK;
+
+	default:
+		return RES_PARERR;
+	}
+}
+
+#endif
+
+// End
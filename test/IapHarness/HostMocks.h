@@ -0,0 +1,91 @@
+/*
+ * HostMocks.h
+ *
+ * Mocked hardware for running the IAP on the build host: flash controller, SD card (at the FatFs diskio level),
+ * the SPI link to the SBC, the PanelDue port and a virtual clock.
+ * Every mocked operation advances the virtual clock by a configurable cost, and may be made to fail at a configurable rate.
+ */
+
+#ifndef TEST_IAPHARNESS_HOSTMOCKS_H_
+#define TEST_IAPHARNESS_HOSTMOCKS_H_
+
+#include <cstddef>
+#include <cstdint>
+
+enum HostFault
+{
+	HostFaultSdRead,			// disk_read() fails
+	HostFaultShortRead,			// f_read() of firmware data returns fewer bytes than asked before the end of the file
+	HostFaultErase,				// flash_erase_sector() reports an error
+	HostFaultNotErased,			// flash_erase_sector() reports success but leaves a word programmed
+	HostFaultProgram,			// flash_write() reports an error and programs nothing
+	HostFaultVerify,			// flash_write() reports success but leaves a byte unprogrammed
+	HostFaultLock,				// flash_lock() or flash_unlock() reports an error
+	HostFaultSbcData,			// the SBC sends a firmware block with a corrupted byte
+	NumHostFaults
+};
+
+extern const char * const hostFaultNames[NumHostFaults];
+
+struct HostFaultSetting
+{
+	double rate;				// probability that an attempt fails
+	uint32_t start, end;		// only inject the fault while the IAP's flashPos is in this range
+};
+
+// Time taken by the mocked operations, in microseconds
+struct HostCosts
+{
+	uint32_t loopMicros;		// each call to millis(), which stands for the CPU time of the code that calls it
+	uint32_t pageWriteMicros;
+	uint32_t eraseMicrosPerKb;
+	uint32_t lockMicros;		// locking or unlocking one call's worth of pages
+	uint32_t sdCommandMicros;	// each disk_read() call
+	uint32_t sdSectorMicros;	// each sector read
+	uint32_t sbcLatencyMicros;	// from the transfer ready signal to the start of the SPI transfer
+	uint32_t spiByteNanos;
+};
+
+struct HostConfig
+{
+	HostFaultSetting faults[NumHostFaults];
+	HostCosts costs;
+	uint32_t seed;
+	uint32_t cardInitMillis;	// how long the SD card takes to come up
+	uint32_t sbcWaitMillis;		// how long the SBC waits after the last firmware block before it asks for the checksum
+	uint64_t timeLimitMicros;	// give up on a run that takes longer than this in virtual time
+	bool verbose;				// print the messages sent to PanelDue
+
+	const uint8_t *flashContents;		// initial flash contents, IFLASH_SIZE bytes
+	const uint8_t *expectedFlash;		// what FirmwareFlashStart..FirmwareFlashEnd must hold after the update
+	const uint8_t *disk;				// SD card image
+	size_t diskSectors;
+	const uint8_t *sbcImage;			// firmware binary sent by the SBC
+	size_t sbcImageSize;
+	const char *ramParameters;			// what RepRapFirmware leaves above the stack: firmware filename and verification level
+	size_t ramParametersLength;
+};
+
+// Outcome of a run, written by the child process into memory shared with the harness
+struct HostResult
+{
+	bool finished;				// the IAP reset the processor
+	bool reportedSuccess;		// ... after reporting that the update succeeded
+	bool bootloaderSelected;	// ... after selecting the bootloader for the next boot
+	bool flashMatches;			// the firmware area holds the expected contents
+	bool timedOut;
+	uint64_t micros;
+	uint32_t retries;
+	uint32_t reflashes;
+	uint32_t faultsInjected[NumHostFaults];
+	char lastMessage[100];
+	char firstError[100];		// the first message that starts with "ERROR:"
+};
+
+extern HostConfig hostConfig;
+extern HostResult *hostResult;
+
+// Set up the mocked flash and RAM and run the IAP. This doesn't return; the run ends when the IAP resets the processor.
+[[noreturn]] void HostRunIap() noexcept;
+
+#endif /* TEST_IAPHARNESS_HOSTMOCKS_H_ */
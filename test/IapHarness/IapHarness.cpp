@@ -0,0 +1,569 @@
+/*
+ * IapHarness.cpp
+ *
+ * Runs the SAM4E build of the IAP on the build host against mocked flash, SD card and SBC, with faults injected
+ * at runtime-configurable rates, and reports whether each update completed and how much time the faults added.
+ * Time is virtual: it is the sum of the costs of the mocked operations and of the IAP's own delays.
+ *
+ * Each run is done in a child process, because the IAP keeps its state in globals and only ends by resetting the processor.
+ */
+
+#include "HostMocks.h"
+#include "iap.h"
+#include "ElfSegments.h"
+#include "../TestSupport.h"
+
+#ifndef IAP_VIA_SPI
+# include "FatImage.h"
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace
+{
+	struct Scenario
+	{
+		std::string name;
+		HostFaultSetting faults[NumHostFaults];
+	};
+
+	struct DefaultFault
+	{
+		HostFault fault;
+		double rate;
+	};
+
+	// The scenarios run when no faults are given on the command line. Each kind of fault is tried on its own.
+#ifdef IAP_VIA_SPI
+	const DefaultFault defaultFaults[] =
+	{
+		{ HostFaultErase, 0.1 }, { HostFaultNotErased, 0.1 }, { HostFaultProgram, 0.005 }, { HostFaultVerify, 0.005 },
+		{ HostFaultLock, 0.005 }, { HostFaultSbcData, 0.005 }
+	};
+#else
+	const DefaultFault defaultFaults[] =
+	{
+		{ HostFaultSdRead, 0.01 }, { HostFaultShortRead, 0.01 }, { HostFaultErase, 0.1 }, { HostFaultNotErased, 0.1 },
+		{ HostFaultProgram, 0.005 }, { HostFaultVerify, 0.005 }, { HostFaultLock, 0.005 }
+	};
+#endif
+
+	struct CostOption
+	{
+		const char *name;
+		uint32_t HostCosts::*cost;
+	};
+
+	const CostOption costOptions[] =
+	{
+		{ "loop", &HostCosts::loopMicros },
+		{ "page-write", &HostCosts::pageWriteMicros },
+		{ "erase-kb", &HostCosts::eraseMicrosPerKb },
+		{ "lock", &HostCosts::lockMicros },
+		{ "sd-command", &HostCosts::sdCommandMicros },
+		{ "sd-sector", &HostCosts::sdSectorMicros },
+		{ "sbc-latency", &HostCosts::sbcLatencyMicros },
+		{ "spi-byte-ns", &HostCosts::spiByteNanos },
+	};
+
+	void Usage()
+	{
+		printf(
+			"Usage: IapHarness [options]\n"
+			"  --fault NAME=RATE[@START-END]  fail that kind of operation with probability RATE, only while the IAP's flash\n"
+			"                                 position is in START..END. May be repeated; all the faults given are combined\n"
+			"                                 in one scenario. Without this option a standard set of scenarios is run.\n"
+			"                                 Names:");
+		for (const char *name : hostFaultNames)
+		{
+			printf(" %s", name);
+		}
+		printf("\n"
+			"  --runs N                       runs of each scenario, each with its own random seed (default 3)\n"
+			"  --seed N                       seed of the first run (default 1)\n"
+			"  --size BYTES                   size of the new firmware (default 307200)\n"
+#ifndef IAP_VIA_SPI
+			"  --format bin|uf2|elf           format of the firmware file (default bin)\n"
+			"  --cluster-sectors N            sectors per cluster of the SD card (default 8)\n"
+			"  --fragment                     leave a free cluster after each cluster of the firmware file\n"
+			"  --filesystem fat16|exfat       file system of the SD card (default fat16). On exFAT the firmware file is\n"
+			"                                 flagged as contiguous unless --fragment is given\n"
+			"  --card-init-ms N               time the SD card takes to initialise (default 150)\n"
+#endif
+			"  --verify full|crc|sampled      verification level passed to the IAP (default none, which means full)\n"
+			"  --cost NAME=MICROSECONDS       cost of a mocked operation. Names:");
+		for (const CostOption& option : costOptions)
+		{
+			printf(" %s", option.name);
+		}
+		printf("\n"
+			"  --require-complete             fail unless every run completes the update\n"
+			"  --expect-error TEXT            fail unless every run with faults retries, then gives up with an error message\n"
+			"                                 that starts with TEXT\n"
+			"  --verbose                      print the messages the IAP sends to PanelDue\n");
+	}
+
+	// Deterministic pseudo-random data for the firmware images
+	std::vector<uint8_t> RandomData(size_t size, uint32_t seed)
+	{
+		std::vector<uint8_t> data(size);
+		for (uint8_t& b : data)
+		{
+			seed = seed * 1103515245u + 12345u;
+			b = (uint8_t)(seed >> 16);
+		}
+		return data;
+	}
+
+	std::vector<uint8_t> ErasedFirmwareArea()
+	{
+		return std::vector<uint8_t>(FirmwareFlashEnd - FirmwareFlashStart, 0xFF);
+	}
+
+#ifndef IAP_VIA_SPI
+
+	// Build an ELF file with the firmware in two segments separated by a gap, plus a .bss segment that has no file data
+	std::vector<uint8_t> MakeElfFile(const std::vector<uint8_t>& firmware, std::vector<uint8_t>& expectedFlash)
+	{
+		const uint32_t textSize = (uint32_t)(firmware.size() * 3 / 4) & ~3u;
+		const uint32_t dataSize = (uint32_t)firmware.size() - textSize;
+		const uint32_t dataAddr = FirmwareFlashStart + textSize + 10000;
+		const uint32_t Load = Elf32_ProgramHeader::TypeLoad;
+		const std::vector<TestSegment> segments =
+		{
+			{ Load, FirmwareFlashStart,		textSize,	textSize,	0, TestSegment::SameAsPaddr,	firmware.data() },				// .text
+			{ Load, dataAddr,				dataSize,	dataSize,	0, IRAM_ADDR,					firmware.data() + textSize },	// .data, copied to RAM
+			{ Load, IRAM_ADDR + dataSize,	0,			0x4000 },																	// .bss
+		};
+
+		expectedFlash = ErasedFirmwareArea();
+		memcpy(expectedFlash.data(), firmware.data(), textSize);
+		memcpy(expectedFlash.data() + (dataAddr - FirmwareFlashStart), firmware.data() + textSize, dataSize);
+		return MakeElf(segments, Elf32_Header::MachineArm, FirmwareFlashStart);
+	}
+
+	// Build a UF2 file with 256 bytes of the firmware in each block. The last block is padded with 0xFF, like erased flash.
+	std::vector<uint8_t> MakeUf2File(const std::vector<uint8_t>& firmware, std::vector<uint8_t>& expectedFlash)
+	{
+		expectedFlash = ErasedFirmwareArea();
+		memcpy(expectedFlash.data(), firmware.data(), firmware.size());
+		return ::MakeUf2File(firmware, FirmwareFlashStart);
+	}
+
+#endif
+
+	bool ParseFault(const char *arg, HostFaultSetting faults[NumHostFaults])
+	{
+		const char * const equals = strchr(arg, '=');
+		if (equals == nullptr)
+		{
+			return false;
+		}
+		for (size_t i = 0; i < NumHostFaults; ++i)
+		{
+			if (strlen(hostFaultNames[i]) == (size_t)(equals - arg) && strncmp(arg, hostFaultNames[i], equals - arg) == 0)
+			{
+				char *end;
+				faults[i].rate = strtod(equals + 1, &end);
+				faults[i].start = 0;
+				faults[i].end = 0xFFFFFFFF;
+				if (*end == '@')
+				{
+					faults[i].start = (uint32_t)strtoul(end + 1, &end, 0);
+					if (*end != '-')
+					{
+						return false;
+					}
+					faults[i].end = (uint32_t)strtoul(end + 1, &end, 0);
+				}
+				return *end == 0 && faults[i].rate >= 0.0 && faults[i].rate <= 1.0;
+			}
+		}
+		return false;
+	}
+
+	bool ParseCost(const char *arg, HostCosts& costs)
+	{
+		for (const CostOption& option : costOptions)
+		{
+			const size_t length = strlen(option.name);
+			if (strncmp(arg, option.name, length) == 0 && arg[length] == '=')
+			{
+				char *end;
+				costs.*option.cost = (uint32_t)strtoul(arg + length + 1, &end, 0);
+				return *end == 0;
+			}
+		}
+		return false;
+	}
+
+	void PrintFaults(const HostFaultSetting faults[NumHostFaults], std::string& name)
+	{
+		for (size_t i = 0; i < NumHostFaults; ++i)
+		{
+			if (faults[i].rate > 0.0)
+			{
+				char buf[80];
+				if (faults[i].start == 0 && faults[i].end == 0xFFFFFFFF)
+				{
+					snprintf(buf, sizeof(buf), "%s%s=%g", name.empty() ? "" : ",", hostFaultNames[i], faults[i].rate);
+				}
+				else
+				{
+					snprintf(buf, sizeof(buf), "%s%s=%g@0x%" PRIx32 "-0x%" PRIx32, name.empty() ? "" : ",", hostFaultNames[i], faults[i].rate, faults[i].start, faults[i].end);
+				}
+				name += buf;
+			}
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	hostConfig.costs.loopMicros = 1;
+	hostConfig.costs.pageWriteMicros = 1500;
+	hostConfig.costs.eraseMicrosPerKb = 1000;
+	hostConfig.costs.lockMicros = 200;
+	hostConfig.costs.sdCommandMicros = 200;
+	hostConfig.costs.sdSectorMicros = 50;
+	hostConfig.costs.sbcLatencyMicros = 500;
+	hostConfig.costs.spiByteNanos = 1000;
+	hostConfig.cardInitMillis = 150;
+	hostConfig.sbcWaitMillis = 500;
+	hostConfig.timeLimitMicros = 600ull * 1000 * 1000;
+
+	unsigned int runs = 3;
+	uint32_t firstSeed = 1;
+	size_t firmwareSize = 307200;
+	const char *format = "bin";
+	unsigned int clusterSectors = 8;
+	bool fragmented = false;
+	bool exFat = false;
+	int verifyLevel = -1;
+	bool requireComplete = false;
+	const char *expectedError = nullptr;
+	bool haveFaults = false;
+	Scenario userScenario;
+	memset(userScenario.faults, 0, sizeof(userScenario.faults));
+
+	for (int i = 1; i < argc; ++i)
+	{
+		const char * const arg = argv[i];
+		const char * const value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+		bool ok = true;
+		if (strcmp(arg, "--fault") == 0 && value != nullptr)
+		{
+			ok = ParseFault(value, userScenario.faults);
+			haveFaults = true;
+			++i;
+		}
+		else if (strcmp(arg, "--runs") == 0 && value != nullptr)
+		{
+			runs = (unsigned int)strtoul(value, nullptr, 0);
+			ok = (runs != 0);
+			++i;
+		}
+		else if (strcmp(arg, "--seed") == 0 && value != nullptr)
+		{
+			firstSeed = (uint32_t)strtoul(value, nullptr, 0);
+			++i;
+		}
+		else if (strcmp(arg, "--size") == 0 && value != nullptr)
+		{
+			firmwareSize = strtoul(value, nullptr, 0);
+			ok = (firmwareSize != 0 && firmwareSize <= FirmwareFlashEnd - FirmwareFlashStart - 16384);
+			++i;
+		}
+#ifndef IAP_VIA_SPI
+		else if (strcmp(arg, "--format") == 0 && value != nullptr)
+		{
+			format = value;
+			ok = (strcmp(format, "bin") == 0 || strcmp(format, "uf2") == 0 || strcmp(format, "elf") == 0);
+			++i;
+		}
+		else if (strcmp(arg, "--cluster-sectors") == 0 && value != nullptr)
+		{
+			clusterSectors = (unsigned int)strtoul(value, nullptr, 0);
+			ok = (clusterSectors != 0 && clusterSectors <= 128 && (clusterSectors & (clusterSectors - 1)) == 0);
+			++i;
+		}
+		else if (strcmp(arg, "--fragment") == 0)
+		{
+			fragmented = true;
+		}
+		else if (strcmp(arg, "--filesystem") == 0 && value != nullptr)
+		{
+			exFat = (strcmp(value, "exfat") == 0);
+			ok = (exFat || strcmp(value, "fat16") == 0);
+			++i;
+		}
+		else if (strcmp(arg, "--card-init-ms") == 0 && value != nullptr)
+		{
+			hostConfig.cardInitMillis = (uint32_t)strtoul(value, nullptr, 0);
+			++i;
+		}
+#endif
+		else if (strcmp(arg, "--verify") == 0 && value != nullptr)
+		{
+			verifyLevel = (strcmp(value, "full") == 0) ? VerifyFull
+							: (strcmp(value, "crc") == 0) ? VerifyCrcOnly
+								: (strcmp(value, "sampled") == 0) ? VerifySampled
+									: -1;
+			ok = (verifyLevel >= 0);
+			++i;
+		}
+		else if (strcmp(arg, "--cost") == 0 && value != nullptr)
+		{
+			ok = ParseCost(value, hostConfig.costs);
+			++i;
+		}
+		else if (strcmp(arg, "--require-complete") == 0)
+		{
+			requireComplete = true;
+		}
+		else if (strcmp(arg, "--expect-error") == 0 && value != nullptr)
+		{
+			expectedError = value;
+			++i;
+		}
+		else if (strcmp(arg, "--verbose") == 0)
+		{
+			hostConfig.verbose = true;
+		}
+		else
+		{
+			ok = false;
+		}
+
+		if (!ok)
+		{
+			Usage();
+			return 2;
+		}
+	}
+
+	// The old firmware fills the whole flash, so that everything the IAP doesn't erase and rewrite shows up
+	const std::vector<uint8_t> oldFlash = RandomData(IFLASH_SIZE, 0xDEADBEEF);
+	const std::vector<uint8_t> firmware = RandomData(firmwareSize, 12345);
+	std::vector<uint8_t> expectedFlash = ErasedFirmwareArea();
+	memcpy(expectedFlash.data(), firmware.data(), firmware.size());
+
+	// What RepRapFirmware passes above the stack: the firmware filename when using the SD card, then the verification level
+	std::string ramParameters;
+#ifdef IAP_VIA_SPI
+	hostConfig.sbcImage = firmware.data();
+	hostConfig.sbcImageSize = firmware.size();
+	const char * const variant = "SAM4E, firmware from the SBC";
+	(void)format;
+	(void)clusterSectors;
+	(void)fragmented;
+	(void)exFat;
+#else
+	std::vector<uint8_t> file;
+	if (strcmp(format, "elf") == 0)
+	{
+		file = MakeElfFile(firmware, expectedFlash);
+	}
+	else if (strcmp(format, "uf2") == 0)
+	{
+		file = MakeUf2File(firmware, expectedFlash);
+	}
+	else
+	{
+		file = firmware;
+	}
+	const std::string fileName = std::string("DuetWiFiFirmware.") + format;
+	const std::vector<uint8_t> disk = (exFat) ? MakeExFatImage("sys", fileName.c_str(), file, clusterSectors, fragmented)
+										: MakeFat16Image("sys", fileName.c_str(), file, clusterSectors, fragmented);
+	hostConfig.disk = disk.data();
+	hostConfig.diskSectors = disk.size() / 512;
+	ramParameters = "0:/sys/" + fileName;
+	ramParameters.push_back(0);
+	const char * const variant = (exFat) ? "SAM4E, firmware from an exFAT SD card" : "SAM4E, firmware from the SD card";
+#endif
+	if (verifyLevel >= 0)
+	{
+		ramParameters += verifyLevelTag;
+		ramParameters.push_back((char)('0' + verifyLevel));
+		ramParameters.push_back(0);
+	}
+	ramParameters.push_back(0);
+	hostConfig.ramParameters = ramParameters.data();
+	hostConfig.ramParametersLength = ramParameters.size();
+	hostConfig.flashContents = oldFlash.data();
+	hostConfig.expectedFlash = expectedFlash.data();
+
+	std::vector<Scenario> scenarios;
+	scenarios.push_back(Scenario());
+	scenarios.back().name = "baseline";
+	memset(scenarios.back().faults, 0, sizeof(scenarios.back().faults));
+	if (haveFaults)
+	{
+		PrintFaults(userScenario.faults, userScenario.name);
+		scenarios.push_back(userScenario);
+	}
+	else
+	{
+		for (const DefaultFault& df : defaultFaults)
+		{
+			Scenario s;
+			memset(s.faults, 0, sizeof(s.faults));
+			s.faults[df.fault].rate = df.rate;
+			s.faults[df.fault].start = 0;
+			s.faults[df.fault].end = 0xFFFFFFFF;
+			PrintFaults(s.faults, s.name);
+			scenarios.push_back(s);
+		}
+	}
+
+	hostResult = static_cast<HostResult *>(mmap(nullptr, sizeof(HostResult), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0));
+	if (hostResult == MAP_FAILED)
+	{
+		perror("IapHarness: mmap");
+		return 2;
+	}
+
+	printf("IAP harness: %s, %zu byte %s firmware, %u run(s) per scenario\n", variant, firmware.size(),
+#ifdef IAP_VIA_SPI
+			"binary",
+#else
+			format,
+#endif
+			runs);
+	printf("%-36s %8s %8s %7s %8s %10s %9s %10s\n", "Scenario", "Updated", "Gave up", "Faults", "Retries", "Reflashes", "Time (s)", "Added (s)");
+
+	std::vector<std::string> problems;
+	double baselineSeconds = 0.0;
+	for (const Scenario& scenario : scenarios)
+	{
+		unsigned int updated = 0, gaveUp = 0;
+		uint64_t totalFaults = 0, totalRetries = 0, totalReflashes = 0;
+		double updatedSeconds = 0.0;
+		for (unsigned int run = 0; run < runs; ++run)
+		{
+			memcpy(hostConfig.faults, scenario.faults, sizeof(hostConfig.faults));
+			hostConfig.seed = firstSeed + run;
+			memset(hostResult, 0, sizeof(HostResult));
+			if (hostConfig.verbose)
+			{
+				printf("== %s, seed %" PRIu32 "\n", scenario.name.c_str(), hostConfig.seed);
+			}
+			fflush(stdout);
+
+			const pid_t pid = fork();
+			if (pid == 0)
+			{
+				alarm(120);
+				HostRunIap();
+			}
+			int status = 0;
+			if (pid < 0 || waitpid(pid, &status, 0) != pid)
+			{
+				perror("IapHarness: fork");
+				return 2;
+			}
+
+			const HostResult& r = *hostResult;
+			char problem[200];
+			problem[0] = 0;
+			if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			{
+				snprintf(problem, sizeof(problem), "crashed (status 0x%x)", status);
+			}
+			else if (r.timedOut)
+			{
+				snprintf(problem, sizeof(problem), "did not finish within the time limit, last message \"%s\"", r.lastMessage);
+			}
+			else if (expectedError != nullptr && &scenario != &scenarios.front())
+			{
+				if (r.reportedSuccess || r.retries == 0 || strncmp(r.firstError, expectedError, strlen(expectedError)) != 0)
+				{
+					snprintf(problem, sizeof(problem), "expected retries and then \"%s\", got %" PRIu32 " retries and \"%s\"",
+								expectedError, r.retries, r.firstError);
+				}
+				++gaveUp;
+			}
+			else if (r.reportedSuccess && !r.flashMatches)
+			{
+				snprintf(problem, sizeof(problem), "reported success but the flash doesn't hold the new firmware");
+			}
+			else if (r.reportedSuccess && r.bootloaderSelected)
+			{
+				snprintf(problem, sizeof(problem), "reported success but selected the bootloader");
+			}
+			else if (r.reportedSuccess)
+			{
+				++updated;
+				updatedSeconds += r.micros / 1000000.0;
+			}
+			else
+			{
+				++gaveUp;
+				if (requireComplete)
+				{
+					snprintf(problem, sizeof(problem), "gave up, last message \"%s\"", r.lastMessage);
+				}
+			}
+#ifndef IAP_VIA_SPI
+			if (problem[0] == 0 && r.retries == 0 && r.faultsInjected[HostFaultSdRead] + r.faultsInjected[HostFaultShortRead] != 0)
+			{
+				snprintf(problem, sizeof(problem), "failed reads were not retried");
+			}
+#endif
+			if (problem[0] != 0)
+			{
+				problems.push_back(scenario.name + ", seed " + std::to_string(hostConfig.seed) + ": " + problem);
+			}
+
+			for (uint32_t n : r.faultsInjected)
+			{
+				totalFaults += n;
+			}
+			totalRetries += r.retries;
+			totalReflashes += r.reflashes;
+		}
+
+		// Counts are averaged over all runs, times over the runs that updated the firmware
+		const double meanSeconds = (updated != 0) ? updatedSeconds / updated : 0.0;
+		char timeText[20], addedText[20];
+		strcpy(timeText, "-");
+		strcpy(addedText, "-");
+		if (updated != 0)
+		{
+			snprintf(timeText, sizeof(timeText), "%.3f", meanSeconds);
+		}
+		if (&scenario == &scenarios.front())
+		{
+			baselineSeconds = meanSeconds;
+			if (updated != runs)
+			{
+				problems.push_back("the baseline scenario did not always complete the update");
+			}
+		}
+		else if (updated != 0)
+		{
+			snprintf(addedText, sizeof(addedText), "%+.3f", meanSeconds - baselineSeconds);
+		}
+		char updatedText[20], gaveUpText[20];
+		snprintf(updatedText, sizeof(updatedText), "%u/%u", updated, runs);
+		snprintf(gaveUpText, sizeof(gaveUpText), "%u/%u", gaveUp, runs);
+		printf("%-36s %8s %8s %7.1f %8.1f %10.1f %9s %10s\n", scenario.name.c_str(), updatedText, gaveUpText,
+				(double)totalFaults / runs, (double)totalRetries / runs, (double)totalReflashes / runs, timeText, addedText);
+	}
+
+	for (const std::string& problem : problems)
+	{
+		printf("FAILED: %s\n", problem.c_str());
+	}
+	return problems.empty() ? 0 : 1;
+}
+
+// End
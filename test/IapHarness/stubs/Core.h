@@ -0,0 +1,136 @@
+/*
+ * Core.h
+ *
+ * Host stand-in for the CoreNG header, so that the SAM4E build of the IAP can be compiled for the test harness.
+ * Peripheral registers are plain structs, and the functions that matter are implemented by the mocks in HostMocks.cpp.
+ */
+
+#ifndef TEST_IAPHARNESS_STUBS_CORE_H_
+#define TEST_IAPHARNESS_STUBS_CORE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+
+#ifndef __cplusplus
+# define noexcept
+#endif
+
+#define ARRAY_SIZE(_x)		(sizeof(_x)/sizeof((_x)[0]))
+
+// Memory map of the SAM4E8E
+#define IFLASH_ADDR			(0x00400000u)
+#define IFLASH_SIZE			(0x00080000u)
+#define IFLASH_PAGE_SIZE	(512u)
+#define IFLASH_LOCK_REGION_SIZE	(8192u)
+#define IRAM_ADDR			(0x20000000u)
+#define IRAM_SIZE			(0x00020000u)
+
+typedef uint8_t Pin;
+#define NoPin				((Pin)0xFF)
+#define PortAPin(_n)		((Pin)(_n))
+#define PortBPin(_n)		((Pin)(32 + (_n)))
+#define PortCPin(_n)		((Pin)(64 + (_n)))
+#define PortDPin(_n)		((Pin)(96 + (_n)))
+
+#define APIN_SPI_MOSI		PortAPin(13)
+#define APIN_SPI_MISO		PortAPin(12)
+#define APIN_SPI_SCK		PortAPin(14)
+#define APIN_SPI_SS0		PortAPin(11)
+
+enum PinMode { INPUT, INPUT_PULLUP, OUTPUT_LOW, OUTPUT_HIGH };
+
+typedef struct
+{
+	volatile uint32_t VTOR;
+} HostScb;
+
+#define SCB_VTOR_TBLOFF_Msk	(0x3FFFFF80u)
+
+typedef struct
+{
+	volatile uint32_t SPI_CR, SPI_MR, SPI_RDR, SPI_TDR, SPI_SR, SPI_IER, SPI_IDR, SPI_IMR;
+} HostSpi;
+
+#define SPI_SR_NSSR			(1u << 8)
+#define SPI_IER_NSSR		(1u << 8)
+#define SPI_CSR_BITS_8_BIT	(0u)
+#define spi_get_pcs(_cs)	((~(1u << (_cs))) & 0x0F)
+
+typedef struct
+{
+	volatile uint32_t DMAC_EBCISR, DMAC_CHER, DMAC_CHDR, DMAC_CHSR;
+} HostDmac;
+
+#define DMAC_CHSR_ENA0		(1u << 0)
+#define DMAC_CHSR_EMPT0		(1u << 16)
+#define DMAC_CHDR_DIS0		(1u << 0)
+#define DMAC_CHDR_RES0		(1u << 8)
+
+enum IRQn_Type { SPI_IRQn = 19, DMAC_IRQn = 35 };
+#define ID_SPI				(19)
+#define ID_DMAC				(35)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern HostScb hostScb;
+extern HostSpi hostSpi;
+extern HostDmac hostDmac;
+
+#define SCB					(&hostScb)
+#define SPI					(&hostSpi)
+#define DMAC				(&hostDmac)
+#define WDT					((void *)0)
+#define RSWDT				((void *)0)
+
+uint32_t millis(void) noexcept;
+void digitalWrite(Pin pin, bool high) noexcept;
+void Reset(void) noexcept;
+
+static inline void pinMode(Pin pin, enum PinMode mode) noexcept { (void)pin; (void)mode; }
+static inline void ConfigurePin(Pin pin) noexcept { (void)pin; }
+static inline void SysTickInit(void) noexcept { }
+static inline void CoreSysTick(void) noexcept { }
+static inline void wdt_restart(void *wdt) noexcept { (void)wdt; }
+static inline void rswdt_restart(void *rswdt) noexcept { (void)rswdt; }
+static inline void cpu_irq_disable(void) noexcept { }
+static inline void cpu_irq_enable(void) noexcept { }
+static inline void pmc_enable_periph_clk(uint32_t id) noexcept { (void)id; }
+static inline void NVIC_DisableIRQ(enum IRQn_Type irq) noexcept { (void)irq; }
+static inline void NVIC_EnableIRQ(enum IRQn_Type irq) noexcept { (void)irq; }
+static inline void NVIC_SetPriority(enum IRQn_Type irq, uint32_t priority) noexcept { (void)irq; (void)priority; }
+
+// SPI driver. Only enabling and disabling the peripheral matters to the SBC model.
+void spi_enable(HostSpi *spi) noexcept;
+void spi_disable(HostSpi *spi) noexcept;
+static inline void spi_enable_clock(HostSpi *spi) noexcept { (void)spi; }
+static inline void spi_reset(HostSpi *spi) noexcept { (void)spi; }
+static inline void spi_set_slave_mode(HostSpi *spi) noexcept { (void)spi; }
+static inline void spi_disable_mode_fault_detect(HostSpi *spi) noexcept { (void)spi; }
+static inline void spi_set_peripheral_chip_select_value(HostSpi *spi, uint32_t value) noexcept { (void)spi; (void)value; }
+static inline void spi_set_clock_polarity(HostSpi *spi, uint32_t cs, uint32_t polarity) noexcept { (void)spi; (void)cs; (void)polarity; }
+static inline void spi_set_clock_phase(HostSpi *spi, uint32_t cs, uint32_t phase) noexcept { (void)spi; (void)cs; (void)phase; }
+static inline void spi_set_bits_per_transfer(HostSpi *spi, uint32_t cs, uint32_t bits) noexcept { (void)spi; (void)cs; (void)bits; }
+
+#ifdef __cplusplus
+}
+
+inline bool XNor(bool a, bool b) noexcept { return a == b; }
+
+// The PanelDue port. Messages written to it are collected by the harness.
+class HostSerial
+{
+public:
+	void begin(uint32_t baudRate) noexcept;
+	void print(const char *str) noexcept;
+};
+
+extern HostSerial Serial;
+
+#endif
+
+#endif /* TEST_IAPHARNESS_STUBS_CORE_H_ */
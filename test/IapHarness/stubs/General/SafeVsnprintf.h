@@ -0,0 +1,18 @@
+/*
+ * SafeVsnprintf.h
+ *
+ * Host stand-in for the RRFLibraries formatting function.
+ */
+
+#ifndef TEST_IAPHARNESS_STUBS_GENERAL_SAFEVSNPRINTF_H_
+#define TEST_IAPHARNESS_STUBS_GENERAL_SAFEVSNPRINTF_H_
+
+#include <cstdarg>
+#include <cstdio>
+
+inline int SafeVsnprintf(char *buffer, size_t maxLen, const char *format, va_list args) noexcept
+{
+	return vsnprintf(buffer, maxLen, format, args);
+}
+
+#endif /* TEST_IAPHARNESS_STUBS_GENERAL_SAFEVSNPRINTF_H_ */
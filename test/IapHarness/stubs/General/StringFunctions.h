@@ -0,0 +1,20 @@
+/*
+ * StringFunctions.h
+ *
+ * Host stand-in for the RRFLibraries string functions used by the IAP.
+ */
+
+#ifndef TEST_IAPHARNESS_STUBS_GENERAL_STRINGFUNCTIONS_H_
+#define TEST_IAPHARNESS_STUBS_GENERAL_STRINGFUNCTIONS_H_
+
+#include <cstring>
+#include <strings.h>
+
+inline bool StringEndsWithIgnoreCase(const char *string, const char *ending) noexcept
+{
+	const size_t j = strlen(string);
+	const size_t k = strlen(ending);
+	return k <= j && strcasecmp(string + j - k, ending) == 0;
+}
+
+#endif /* TEST_IAPHARNESS_STUBS_GENERAL_STRINGFUNCTIONS_H_ */
@@ -0,0 +1,27 @@
+/*
+ * HostIntegers.h
+ *
+ * FatFs integer types with the sizes they have on the ARM targets. FatFs' own integer.h makes DWORD an unsigned long,
+ * which is 64 bits wide on the host. This file is force-included ahead of it, so that integer.h sees _INTEGER already defined.
+ */
+
+#ifndef _INTEGER
+#define _INTEGER
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef int				INT;
+typedef size_t			UINT;		// same width as size_t, as on the ARM targets, because the IAP passes size_t pointers to f_read()
+typedef char			CHAR;
+typedef unsigned char	UCHAR;
+typedef unsigned char	BYTE;
+typedef short			SHORT;
+typedef unsigned short	USHORT;
+typedef unsigned short	WORD;
+typedef unsigned short	WCHAR;
+typedef int32_t			LONG;
+typedef uint32_t		ULONG;
+typedef uint32_t		DWORD;
+
+#endif
@@ -0,0 +1,55 @@
+/*
+ * dmac.h
+ *
+ * Host stand-in for the ASF DMAC driver. The SBC model in HostMocks.cpp moves the data of a transfer
+ * between the addresses that the IAP programs into the receive and transmit channels.
+ */
+
+#ifndef TEST_IAPHARNESS_STUBS_DMAC_DMAC_H_
+#define TEST_IAPHARNESS_STUBS_DMAC_DMAC_H_
+
+#include <Core.h>
+
+#define DMAC_PRIORITY_ROUND_ROBIN			(1u)
+
+#define DMAC_CTRLA_SRC_WIDTH_BYTE			(0u << 24)
+#define DMAC_CTRLA_SRC_WIDTH_WORD			(2u << 24)
+#define DMAC_CTRLA_DST_WIDTH_BYTE			(0u << 28)
+#define DMAC_CTRLA_DST_WIDTH_WORD			(2u << 28)
+#define DMAC_CTRLB_SRC_DSCR					(1u << 16)
+#define DMAC_CTRLB_DST_DSCR					(1u << 20)
+#define DMAC_CTRLB_FC_MEM2PER_DMA_FC		(1u << 21)
+#define DMAC_CTRLB_FC_PER2MEM_DMA_FC		(2u << 21)
+#define DMAC_CTRLB_SRC_INCR_INCREMENTING	(0u << 24)
+#define DMAC_CTRLB_SRC_INCR_FIXED			(2u << 24)
+#define DMAC_CTRLB_DST_INCR_INCREMENTING	(0u << 28)
+#define DMAC_CTRLB_DST_INCR_FIXED			(2u << 28)
+#define DMAC_CFG_SRC_PER(_p)				((uint32_t)(_p) & 0x0F)
+#define DMAC_CFG_DST_PER(_p)				(((uint32_t)(_p) & 0x0F) << 4)
+#define DMAC_CFG_SRC_H2SEL					(1u << 9)
+#define DMAC_CFG_DST_H2SEL					(1u << 13)
+#define DMAC_CFG_SOD						(1u << 16)
+#define DMAC_CFG_FIFOCFG_ASAP_CFG			(2u << 28)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void dmac_channel_enable(HostDmac *dmac, uint32_t channel) noexcept;
+void dmac_channel_disable(HostDmac *dmac, uint32_t channel) noexcept;
+void dmac_channel_set_source_addr(HostDmac *dmac, uint32_t channel, uint32_t addr) noexcept;
+void dmac_channel_set_destination_addr(HostDmac *dmac, uint32_t channel, uint32_t addr) noexcept;
+
+static inline void dmac_init(HostDmac *dmac) noexcept { (void)dmac; }
+static inline void dmac_enable(HostDmac *dmac) noexcept { (void)dmac; }
+static inline void dmac_set_priority_mode(HostDmac *dmac, uint32_t mode) noexcept { (void)dmac; (void)mode; }
+static inline void dmac_channel_set_descriptor_addr(HostDmac *dmac, uint32_t channel, uint32_t addr) noexcept { (void)dmac; (void)channel; (void)addr; }
+static inline void dmac_channel_set_ctrlA(HostDmac *dmac, uint32_t channel, uint32_t ctrlA) noexcept { (void)dmac; (void)channel; (void)ctrlA; }
+static inline void dmac_channel_set_ctrlB(HostDmac *dmac, uint32_t channel, uint32_t ctrlB) noexcept { (void)dmac; (void)channel; (void)ctrlB; }
+static inline void dmac_channel_set_configuration(HostDmac *dmac, uint32_t channel, uint32_t cfg) noexcept { (void)dmac; (void)channel; (void)cfg; }
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TEST_IAPHARNESS_STUBS_DMAC_DMAC_H_ */
@@ -0,0 +1,30 @@
+/*
+ * flash_efc.h
+ *
+ * Host stand-in for the ASF flash driver. The mock flash is implemented in HostMocks.cpp.
+ */
+
+#ifndef TEST_IAPHARNESS_STUBS_FLASH_EFC_H_
+#define TEST_IAPHARNESS_STUBS_FLASH_EFC_H_
+
+#include <Core.h>
+
+#define FLASH_RC_OK			0
+#define FLASH_RC_ERROR		0x10
+#define FLASH_RC_INVALID	0x11
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint32_t flash_unlock(uint32_t ul_start, uint32_t ul_end, uint32_t *pul_actual_start, uint32_t *pul_actual_end) noexcept;
+uint32_t flash_lock(uint32_t ul_start, uint32_t ul_end, uint32_t *pul_actual_start, uint32_t *pul_actual_end) noexcept;
+uint32_t flash_erase_sector(uint32_t ul_address) noexcept;
+uint32_t flash_write(uint32_t ul_address, const void *p_buffer, uint32_t ul_size, uint32_t ul_erase_flag) noexcept;
+uint32_t flash_clear_gpnvm(uint32_t ul_gpnvm) noexcept;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TEST_IAPHARNESS_STUBS_FLASH_EFC_H_ */
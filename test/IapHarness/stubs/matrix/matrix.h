@@ -0,0 +1,19 @@
+/*
+ * matrix.h
+ *
+ * Host stand-in for the ASF bus matrix driver. The bus matrix settings have no effect on the host.
+ */
+
+#ifndef TEST_IAPHARNESS_STUBS_MATRIX_MATRIX_H_
+#define TEST_IAPHARNESS_STUBS_MATRIX_MATRIX_H_
+
+#include <Core.h>
+
+#define MATRIX_DEFMSTR_LAST_DEFAULT_MASTER	(1u)
+#define MATRIX_PRAS0_M4PR_Pos				(16)
+
+static inline void matrix_set_slave_default_master_type(uint32_t slave, uint32_t type) noexcept { (void)slave; (void)type; }
+static inline void matrix_set_slave_priority(uint32_t slave, uint32_t priority) noexcept { (void)slave; (void)priority; }
+static inline void matrix_set_slave_slot_cycle(uint32_t slave, uint32_t cycles) noexcept { (void)slave; (void)cycles; }
+
+#endif /* TEST_IAPHARNESS_STUBS_MATRIX_MATRIX_H_ */
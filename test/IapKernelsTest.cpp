@@ -0,0 +1,115 @@
+/*
+ * IapKernelsTest.cpp
+ *
+ * Host test of the loops that the IAP runs over the new firmware: CRC16, the blank check and unpacking UF2 blocks.
+ */
+
+#include "IapKernels.h"
+#include "TestSupport.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+	unsigned int failures = 0;
+
+	// Bit by bit CRC-16 with the reflected polynomial 0xA001, to check the table driven one against
+	uint16_t ReferenceCrc16(const std::vector<char>& data, uint16_t crc)
+	{
+		for (char c : data)
+		{
+			crc ^= (uint8_t)c;
+			for (int bit = 0; bit < 8; ++bit)
+			{
+				crc = (crc & 1) ? (uint16_t)((crc >> 1) ^ 0xA001) : (uint16_t)(crc >> 1);
+			}
+		}
+		return crc;
+	}
+
+	// A block for TARGETADDR with a pattern in its payload
+	UF2_Block SampleUf2Block(uint32_t targetAddr)
+	{
+		uint8_t payload[UF2_Block::DuetPayloadSize];
+		for (size_t i = 0; i < sizeof(payload); ++i)
+		{
+			payload[i] = (uint8_t)(i * 3 + 1);
+		}
+		return MakeUf2Block(targetAddr, 0, 1, payload, sizeof(payload));
+	}
+}
+
+static void TestCrc16()
+{
+	const char * const check = "123456789";
+	CHECK(CRC16(check, 9, 0) == 0xBB3D);								// CRC-16/ARC
+	CHECK(CRC16(check, 9, 65535) == 0x4B37);							// CRC-16/MODBUS, the start value the IAP uses
+	CHECK(CRC16(check, 0, 1234) == 1234);
+
+	// Bytes with the top bit set, because char is signed on the host and unsigned on the ARM targets
+	std::vector<char> data(1000);
+	for (size_t i = 0; i < data.size(); ++i)
+	{
+		data[i] = (char)(i * 37 + (i >> 3));
+	}
+	const uint16_t whole = CRC16(data.data(), data.size(), 65535);
+	CHECK(whole == ReferenceCrc16(data, 65535));
+	CHECK(CRC16(data.data() + 300, data.size() - 300, CRC16(data.data(), 300, 65535)) == whole);	// the IAP builds the CRC a page at a time
+}
+
+static void TestIsBlank()
+{
+	std::vector<uint32_t> area(2048, 0xFFFFFFFF);
+	CHECK(IsBlank(area.data(), area.size() * sizeof(uint32_t)));
+	CHECK(IsBlank(area.data(), 0));
+	reinterpret_cast<uint8_t*>(area.data())[area.size() * sizeof(uint32_t) - 1] = 0xFE;
+	CHECK(!IsBlank(area.data(), area.size() * sizeof(uint32_t)));
+	CHECK(IsBlank(area.data(), (area.size() - 1) * sizeof(uint32_t)));
+	area[0] = 0;
+	CHECK(!IsBlank(area.data(), sizeof(uint32_t)));
+}
+
+static void TestUf2Block()
+{
+	const uint32_t addr = 0x00400100;
+	char dest[UF2_Block::DuetPayloadSize + 4];
+	memset(dest, 0x55, sizeof(dest));
+	UF2_Block block = SampleUf2Block(addr);
+	CHECK(CopyUf2Block(block, addr, dest) == Uf2Error::none);
+	CHECK(memcmp(dest, block.data, UF2_Block::DuetPayloadSize) == 0);
+	CHECK(dest[UF2_Block::DuetPayloadSize] == 0x55);					// nothing is copied past the payload
+
+	memset(dest, 0x55, sizeof(dest));
+	CHECK(CopyUf2Block(block, addr + UF2_Block::DuetPayloadSize, dest) == Uf2Error::unexpectedData);
+	CHECK(dest[0] == 0x55);												// nothing is copied from a block that fails
+
+	block.payloadSize = 476;
+	CHECK(CopyUf2Block(block, addr, dest) == Uf2Error::unexpectedData);
+
+	block = SampleUf2Block(addr);
+	block.magicStart1 ^= 1;
+	CHECK(CopyUf2Block(block, addr, dest) == Uf2Error::badBlock);
+	block = SampleUf2Block(addr);
+	block.magicEnd = 0;
+	CHECK(CopyUf2Block(block, addr, dest) == Uf2Error::badBlock);
+	CHECK(dest[0] == 0x55);
+}
+
+int main()
+{
+	TestCrc16();
+	TestIsBlank();
+	TestUf2Block();
+
+	if (failures != 0)
+	{
+		printf("IapKernelsTest: %u checks failed\n", failures);
+		return 1;
+	}
+	printf("IapKernelsTest: all checks passed\n");
+	return 0;
+}
+
+// End
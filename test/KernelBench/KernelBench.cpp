@@ -0,0 +1,216 @@
+/*
+ * KernelBench.cpp
+ *
+ * Runs the loops that the IAP runs over every byte of the new firmware, in the way the IAP calls them: CRC16 and the verify
+ * memcmp a flash page at a time, the blank check over a whole area, UF2 blocks into the 2K read buffer, and f_read of the
+ * firmware file in 2K chunks. It builds for the host and for the QEMU Cortex-M boards (see KernelBench/qemu).
+ *
+ *   KernelBench KERNEL LENGTH REPEATS
+ *
+ * KERNEL is crc16, blank, verify, uf2, fread or all. The inputs of LENGTH bytes are set up once and the kernel then runs
+ * REPEATS times over them, so the difference between the instruction counts of two runs with different REPEATS is the
+ * cost of the kernel alone. tools/kernel_bench.py does that.
+ */
+
+#include "IapKernels.h"
+#include "RamDisk.h"
+#include "../IapHarness/FatImage.h"
+#include "../TestSupport.h"
+#include "ff.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+	const size_t PageSize = 512;						// flash page size of the SAM4E, SAM4S and SAME70
+	const size_t BlockReadSize = 2048;					// the IAP's blockReadSize
+	const uint32_t FlashStart = 0x00400000;
+	const unsigned int SectorsPerCluster = 64;			// 32K clusters, as SD cards are normally formatted
+
+	alignas(4) char readData[BlockReadSize];
+
+	// Stop the compiler from merging the repeats of a kernel whose result it could otherwise reuse, such as memcmp
+	inline void Barrier()
+	{
+		__asm__ volatile("" ::: "memory");
+	}
+
+	std::vector<char> MakeData(size_t length)
+	{
+		std::vector<char> data(length);
+		for (size_t i = 0; i < length; ++i)
+		{
+			data[i] = (char)(i * 37 + (i >> 9));
+		}
+		return data;
+	}
+
+	bool BenchCrc16(size_t length, unsigned int repeats)
+	{
+		const std::vector<char> data = MakeData(length);
+		uint16_t crc = 0;
+		for (unsigned int r = 0; r < repeats; ++r)
+		{
+			crc = 65535;
+			for (size_t offset = 0; offset + PageSize <= length; offset += PageSize)
+			{
+				crc = CRC16(data.data() + offset, PageSize, crc);
+			}
+			Barrier();
+		}
+		printf("crc16 %u bytes x %u: CRC 0x%04x\n", (unsigned int)length, repeats, crc);
+		return true;
+	}
+
+	bool BenchBlank(size_t length, unsigned int repeats)
+	{
+		const std::vector<uint32_t> area(length / sizeof(uint32_t), 0xFFFFFFFF);
+		bool blank = true;
+		for (unsigned int r = 0; r < repeats; ++r)
+		{
+			blank = blank && IsBlank(area.data(), length);
+			Barrier();
+		}
+		printf("blank %u bytes x %u: %s\n", (unsigned int)length, repeats, (blank) ? "blank" : "NOT BLANK");
+		return blank;
+	}
+
+	bool BenchVerify(size_t length, unsigned int repeats)
+	{
+		const std::vector<char> written = MakeData(length);
+		const std::vector<char> flash = written;
+		bool same = true;
+		for (unsigned int r = 0; r < repeats; ++r)
+		{
+			for (size_t offset = 0; offset + PageSize <= length; offset += PageSize)
+			{
+				same = same && memcmp(written.data() + offset, flash.data() + offset, PageSize) == 0;
+			}
+			Barrier();
+		}
+		printf("verify %u bytes x %u: %s\n", (unsigned int)length, repeats, (same) ? "same" : "DIFFERENT");
+		return same;
+	}
+
+	// LENGTH is the size of the .uf2 file, which holds half as much firmware
+	bool BenchUf2(size_t length, unsigned int repeats)
+	{
+		const size_t numBlocks = length / sizeof(UF2_Block);
+		std::vector<UF2_Block> file(numBlocks);
+		uint8_t payload[UF2_Block::DuetPayloadSize];
+		for (size_t i = 0; i < numBlocks; ++i)
+		{
+			memset(payload, (int)i, sizeof(payload));
+			file[i] = MakeUf2Block(FlashStart + i * UF2_Block::DuetPayloadSize, i, numBlocks, payload, sizeof(payload));
+		}
+
+		const size_t blocksPerBuffer = BlockReadSize / UF2_Block::DuetPayloadSize;
+		bool ok = true;
+		for (unsigned int r = 0; r < repeats; ++r)
+		{
+			for (size_t i = 0; i < numBlocks; ++i)
+			{
+				ok = ok && CopyUf2Block(file[i], FlashStart + i * UF2_Block::DuetPayloadSize, readData + (i % blocksPerBuffer) * UF2_Block::DuetPayloadSize) == Uf2Error::none;
+			}
+			Barrier();
+		}
+		printf("uf2 %u bytes x %u: %s\n", (unsigned int)length, repeats, (ok) ? "unpacked" : "BAD BLOCK");
+		return ok;
+	}
+
+	bool BenchFileRead(size_t length, unsigned int repeats)
+	{
+		std::vector<uint8_t> contents(length);
+		for (size_t i = 0; i < length; ++i)
+		{
+			contents[i] = (uint8_t)(i * 37 + (i >> 9));
+		}
+		const std::vector<uint8_t> disk = MakeFat16Image("sys", "DuetWiFiFirmware.bin", contents, SectorsPerCluster, false, true);
+		SetRamDisk(disk.data(), disk.size() / 512);
+
+		static FATFS fs;
+		static FIL file;
+		if (f_mount(0, &fs) != FR_OK || f_open(&file, "0:/sys/DuetWiFiFirmware.bin", FA_OPEN_EXISTING | FA_READ) != FR_OK)
+		{
+			printf("fread: cannot open the file\n");
+			return false;
+		}
+
+		size_t total = 0;
+		for (unsigned int r = 0; r < repeats; ++r)
+		{
+			if (f_lseek(&file, 0) != FR_OK)
+			{
+				printf("fread: f_lseek failed\n");
+				return false;
+			}
+			total = 0;
+			for (;;)
+			{
+				size_t bytesRead;
+				if (f_read(&file, readData, BlockReadSize, &bytesRead) != FR_OK)
+				{
+					printf("fread: f_read failed\n");
+					return false;
+				}
+				if (bytesRead == 0)
+				{
+					break;
+				}
+				total += bytesRead;
+			}
+		}
+		const bool ok = total == length && memcmp(readData, contents.data() + length - BlockReadSize, BlockReadSize) == 0;
+		printf("fread %u bytes x %u: %s\n", (unsigned int)length, repeats, (ok) ? "read" : "WRONG DATA");
+		f_close(&file);
+		return ok;
+	}
+
+	struct Kernel
+	{
+		const char *name;
+		bool (*run)(size_t length, unsigned int repeats);
+	};
+
+	const Kernel kernels[] =
+	{
+		{ "crc16",	BenchCrc16 },
+		{ "blank",	BenchBlank },
+		{ "verify",	BenchVerify },
+		{ "uf2",	BenchUf2 },
+		{ "fread",	BenchFileRead },
+	};
+}
+
+int main(int argc, char *argv[])
+{
+	const size_t length = (argc == 4) ? strtoul(argv[2], nullptr, 0) : 0;
+	const unsigned int repeats = (argc == 4) ? (unsigned int)strtoul(argv[3], nullptr, 0) : 0;
+	if (length == 0 || length % BlockReadSize != 0 || repeats == 0)
+	{
+		printf("Usage: KernelBench crc16|blank|verify|uf2|fread|all LENGTH REPEATS\n"
+				"LENGTH must be a multiple of %u bytes\n", (unsigned int)BlockReadSize);
+		return 1;
+	}
+
+	bool found = false;
+	bool ok = true;
+	for (const Kernel& k : kernels)
+	{
+		if (strcmp(argv[1], "all") == 0 || strcmp(argv[1], k.name) == 0)
+		{
+			found = true;
+			ok = k.run(length, repeats) && ok;
+		}
+	}
+	if (!found)
+	{
+		printf("Unknown kernel %s\n", argv[1]);
+	}
+	return (found && ok) ? 0 : 1;
+}
+
+// End
@@ -0,0 +1,59 @@
+/*
+ * RamDisk.cpp
+ *
+ * FatFs disk functions for the kernel benchmark. Drive 0 is a FAT image in memory. Sectors are copied with memcpy
+ * where the SD card driver would use DMA, so the f_read figures include that copy but no waiting for the card.
+ */
+
+#include "RamDisk.h"
+
+extern "C"
+{
+#include "diskio.h"
+}
+
+#include <cstring>
+
+namespace
+{
+	const size_t SectorSize = 512;
+
+	const uint8_t *diskImage = nullptr;
+	size_t diskSectors = 0;
+}
+
+void SetRamDisk(const uint8_t *image, size_t numSectors) noexcept
+{
+	diskImage = image;
+	diskSectors = numSectors;
+}
+
+extern "C" DSTATUS disk_initialize(BYTE drv)
+{
+	return (drv == 0 && diskImage != nullptr) ? 0 : STA_NOINIT;
+}
+
+extern "C" DSTATUS disk_status(BYTE drv)
+{
+	return (drv == 0 && diskImage != nullptr) ? 0 : STA_NOINIT;
+}
+
+extern "C" DRESULT disk_read(BYTE drv, BYTE *buff, DWORD sector, BYTE count)
+{
+	if (drv != 0 || sector + count > diskSectors)
+	{
+		return RES_PARERR;
+	}
+	memcpy(buff, diskImage + (size_t)sector * SectorSize, (size_t)count * SectorSize);
+	return RES_OK;
+}
+
+extern "C" DRESULT disk_ioctl(BYTE drv, BYTE ctrl, void *buff)
+{
+	(void)drv;
+	(void)ctrl;
+	(void)buff;
+	return RES_PARERR;
+}
+
+// End
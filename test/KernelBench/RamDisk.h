@@ -0,0 +1,16 @@
+/*
+ * RamDisk.h
+ *
+ * FatFs disk functions for the kernel benchmark, reading a FAT image in memory.
+ */
+
+#ifndef TEST_KERNELBENCH_RAMDISK_H_
+#define TEST_KERNELBENCH_RAMDISK_H_
+
+#include <cstddef>
+#include <cstdint>
+
+// Make drive 0 read from the given image, which must stay in memory while it is mounted
+void SetRamDisk(const uint8_t *image, size_t numSectors) noexcept;
+
+#endif /* TEST_KERNELBENCH_RAMDISK_H_ */
@@ -0,0 +1,108 @@
+/*
+ * Startup.c
+ *
+ * Startup code for running KernelBench on QEMU's MPS2 Cortex-M boards. The command line and the output go through
+ * Arm semihosting, so QEMU must be run with "-semihosting-config enable=on,target=native,arg=...".
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define SYS_WRITE0				0x04
+#define SYS_GET_CMDLINE			0x15
+#define SYS_EXIT				0x18
+#define ADP_STOPPED_APP_EXIT	0x20026		// QEMU exits with status 0
+#define ADP_STOPPED_RUNTIME_ERR	0x20023		// QEMU exits with status 1
+
+#define MAX_ARGS				8
+
+extern uint32_t __bss_start__, __bss_end__, __stack_top;
+extern int main(int argc, char *argv[]);
+extern void __libc_init_array(void);
+
+static int Semihost(int op, void *arg)
+{
+	register int r0 __asm__("r0") = op;
+	register void *r1 __asm__("r1") = arg;
+	__asm__ volatile("bkpt 0xAB" : "+r"(r0) : "r"(r1) : "memory");
+	return r0;
+}
+
+static void __attribute__((noreturn)) Exit(int reason)
+{
+	Semihost(SYS_EXIT, (void *)(uintptr_t)reason);
+	for (;;) { }
+}
+
+// Called by newlib's stdio. Everything goes to the QEMU console.
+int _write(int fd, const char *buf, int len)
+{
+	(void)fd;
+	char chunk[65];
+	for (int done = 0; done < len; )
+	{
+		const int n = (len - done < (int)sizeof(chunk) - 1) ? len - done : (int)sizeof(chunk) - 1;
+		memcpy(chunk, buf + done, n);
+		chunk[n] = 0;
+		Semihost(SYS_WRITE0, chunk);
+		done += n;
+	}
+	return len;
+}
+
+// __libc_init_array calls this. There is nothing to do because the C runtime start files are not linked.
+void _init(void) { }
+
+void Default_Handler(void)
+{
+	Semihost(SYS_WRITE0, "Unexpected exception\n");
+	Exit(ADP_STOPPED_RUNTIME_ERR);
+}
+
+void Reset_Handler(void)
+{
+#if defined(__ARM_FP)
+	*(volatile uint32_t *)0xE000ED88 |= 0x0Fu << 20;		// CPACR: full access to CP10 and CP11, the FPU
+	__asm__ volatile("dsb\n\tisb");
+#endif
+	for (uint32_t *p = &__bss_start__; p < &__bss_end__; ++p)
+	{
+		*p = 0;
+	}
+	__libc_init_array();
+
+	// QEMU passes the program name and the arguments separated by spaces
+	static char cmdline[128];
+	struct { char *buffer; int length; } cmdlineBlock = { cmdline, sizeof(cmdline) };
+	int argc = 0;
+	char *argv[MAX_ARGS + 1];
+	if (Semihost(SYS_GET_CMDLINE, &cmdlineBlock) == 0)
+	{
+		for (char *p = strtok(cmdline, " "); p != NULL && argc < MAX_ARGS; p = strtok(NULL, " "))
+		{
+			argv[argc++] = p;
+		}
+	}
+	argv[argc] = NULL;
+	Exit((main(argc, argv) == 0) ? ADP_STOPPED_APP_EXIT : ADP_STOPPED_RUNTIME_ERR);
+}
+
+__attribute__((section(".vectors"), used)) static void (* const vectors[16])(void) =
+{
+	(void (*)(void))&__stack_top,
+	Reset_Handler,
+	Default_Handler,		// NMI
+	Default_Handler,		// HardFault
+	Default_Handler,		// MemManage
+	Default_Handler,		// BusFault
+	Default_Handler,		// UsageFault
+	NULL, NULL, NULL, NULL,
+	Default_Handler,		// SVCall
+	Default_Handler,		// DebugMonitor
+	NULL,
+	Default_Handler,		// PendSV
+	Default_Handler,		// SysTick
+};
+
+// End
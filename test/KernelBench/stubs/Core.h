@@ -0,0 +1,15 @@
+/*
+ * Core.h
+ *
+ * Stand-in for the CoreNG header, which FatFs' diskio.h includes. The benchmark needs nothing from it but the standard headers.
+ */
+
+#ifndef TEST_KERNELBENCH_STUBS_CORE_H_
+#define TEST_KERNELBENCH_STUBS_CORE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+
+#endif /* TEST_KERNELBENCH_STUBS_CORE_H_ */
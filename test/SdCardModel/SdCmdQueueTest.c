@@ -0,0 +1,449 @@
+/*
+ * SdCmdQueueTest.c
+ *
+ * Runs the sd_mmc driver on the host against a model of an SD card on the HSMCI interface, to check that command queueing
+ * is detected from the SD Status and enabled while the card is initialised. The model checks the protocol as commands
+ * arrive, including that no task commands (CMD43-CMD46) are sent. Each case then checks the queue depth and reads.
+ * The last case makes multiple block reads fail part way through and checks that the card is left stopped and deselected.
+ */
+
+#include "Core.h"
+#include "hsmci/hsmci.h"
+#include "sd_mmc_protocol.h"
+#include "sd_mmc.h"
+#include "sd_mmc_mem.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define EXTR_PERF_FNO		2			// where the model puts the performance enhancement register set
+#define EXTR_PERF_PAGE		1
+#define EXTR_PERF_OFFSET	0x10
+
+// How the modelled card behaves
+struct CardConfig
+{
+	bool highCapacity;
+	uint8_t perfClass;					// application performance class, 2 for A2
+	uint8_t cmdqSupport;				// queue depth - 1, or 0 if command queueing is not supported
+	bool rejectEnable;					// the command queue enable bit reads back as 0
+};
+
+static struct CardConfig card;
+static bool appCommand;					// the last command was CMD55
+static bool cmdqEnabled;
+static uint8_t perfRegs[SD_EXTR_BSIZE];
+static uint32_t response;
+static unsigned int dataCommand;		// command of the current data transfer, plus 100 for application commands
+static uint32_t dataArg;
+static uint32_t readPos;				// next block of the current CMD17 or CMD18
+static bool cardSelected;
+static bool multiBlockReadOpen;			// a CMD18 has been sent and not yet stopped by CMD12
+static bool failStartRead;				// the next CMD18 data transfer fails to start
+static bool failWaitRead;				// the next CMD18 data transfer fails while waiting for it to end
+
+static unsigned long commandCount[64];
+static unsigned long blocksRead;
+static unsigned long queueSetupCommands;	// ACMD13, CMD48 and CMD49
+static unsigned int protocolErrors;
+
+static void ProtocolError(const char *message)
+{
+	printf("  PROTOCOL ERROR: %s\n", message);
+	++protocolErrors;
+}
+
+// Every block holds its own block number followed by a pattern, so that misplaced data is easy to spot
+static void FillBlock(uint8_t *p, uint32_t block)
+{
+	for (size_t i = 0; i < SD_MMC_BLOCK_SIZE; ++i)
+	{
+		p[i] = (uint8_t)(block * 7 + i);
+	}
+	memcpy(p, &block, sizeof(block));
+}
+
+// Extension register space, page 0 of function 0: the general information, listing two extensions.
+// The second one is the performance enhancement register set.
+static void FillGeneralInfo(uint8_t *p)
+{
+	memset(p, 0, SD_EXTR_BSIZE);
+	p[2] = 0x70;										// length of the general information
+	p[4] = 2;											// number of extensions
+
+	const uint32_t otherAddr = (1u << 18);				// function 1, page 0, offset 0
+	p[16] = 1;											// standard function code of something else
+	p[16 + 40] = 64;									// next extension
+	p[16 + 42] = 1;										// number of register sets
+	memcpy(p + 16 + 44, &otherAddr, sizeof(otherAddr));
+
+	const uint32_t perfAddr = ((uint32_t)EXTR_PERF_FNO << 18) | ((uint32_t)EXTR_PERF_PAGE << 9) | EXTR_PERF_OFFSET;
+	p[64] = SD_EXTR_SFC_PERF_ENHANCEMENT;
+	p[64 + 42] = 1;
+	memcpy(p + 64 + 44, &perfAddr, sizeof(perfAddr));
+}
+
+void hsmci_init(void) noexcept { }
+void hsmci_select_device(uint8_t slot, uint32_t clock, uint8_t bus_width, bool high_speed) noexcept { cardSelected = true; }
+void hsmci_deselect_device(uint8_t slot) noexcept { cardSelected = false; }
+uint8_t hsmci_get_bus_width(uint8_t slot) noexcept { return 4; }
+bool hsmci_is_high_speed_capable(void) noexcept { return true; }
+void hsmci_send_clock(void) noexcept { }
+uint32_t hsmci_get_response(void) noexcept { return response; }
+uint32_t hsmci_get_speed(void) noexcept { return 0; }
+driverIdleFunc_t hsmci_set_idle_func(driverIdleFunc_t func) noexcept { return NULL; }
+bool hsmci_read_word(uint32_t* value) noexcept { return false; }
+bool hsmci_write_word(uint32_t value) noexcept { return false; }
+
+bool hsmci_wait_end_of_read_blocks(void) noexcept
+{
+	if (failWaitRead && dataCommand == 18)
+	{
+		failWaitRead = false;
+		return false;
+	}
+	return true;
+}
+
+bool hsmci_wait_end_of_write_blocks(void) noexcept { return true; }
+
+// CSD version 2.0 with C_SIZE 1000
+void hsmci_get_response_128(uint8_t* r) noexcept
+{
+	const uint32_t cSize = 1000;
+	memset(r, 0, 16);
+	r[0] = 0x40;
+	r[3] = 0x32;
+	r[7] = (uint8_t)((cSize >> 16) & 0x3F);
+	r[8] = (uint8_t)(cSize >> 8);
+	r[9] = (uint8_t)cSize;
+}
+
+bool hsmci_send_cmd(sdmmc_cmd_def_t cmd, uint32_t arg) noexcept
+{
+	const unsigned int index = SDMMC_CMD_GET_INDEX(cmd);
+	++commandCount[index];
+	const bool app = appCommand;
+	appCommand = false;
+	response = 0x900;									// READY_FOR_DATA, state TRAN
+
+	if (app)
+	{
+		switch (index)
+		{
+		case 41:
+			response = OCR_POWER_UP_BUSY | ((card.highCapacity) ? OCR_CCS : 0) | 0xFF8000;
+			return true;
+		case 6:
+			return true;
+		default:
+			ProtocolError("unexpected application command");
+			return false;
+		}
+	}
+
+	switch (index)
+	{
+	case 0:
+	case 2:
+	case 7:
+	case 9:
+	case 16:
+		return true;
+
+	case 12:
+		multiBlockReadOpen = false;
+		return true;
+
+	case 3:
+		response = 0x1234u << 16;
+		return true;
+
+	case 8:
+		response = arg & 0xFFF;
+		return true;
+
+	case 55:
+		appCommand = true;
+		return true;
+
+	case 13:
+		if (arg & SD_CMD13_SEND_TASK_STATUS)
+		{
+			ProtocolError("task status requested");
+		}
+		return true;
+
+	default:
+		printf("  CMD%u\n", index);
+		ProtocolError("unexpected command");
+		return false;
+	}
+}
+
+bool hsmci_adtc_start(sdmmc_cmd_def_t cmd, uint32_t arg, uint16_t block_size, uint16_t nb_block, bool access_block) noexcept
+{
+	const unsigned int index = SDMMC_CMD_GET_INDEX(cmd);
+	++commandCount[index];
+	const bool app = appCommand;
+	appCommand = false;
+	dataCommand = (app) ? 100 + index : index;
+	dataArg = arg;
+	response = 0x900;
+
+	if (index == 17 || index == 18)
+	{
+		if (multiBlockReadOpen)
+		{
+			ProtocolError("read started while a CMD18 is still open");
+		}
+		readPos = (card.highCapacity) ? arg : arg / SD_MMC_BLOCK_SIZE;
+		multiBlockReadOpen = (index == 18);
+	}
+	if (index == 46)
+	{
+		ProtocolError("queued task executed");
+	}
+	if (dataCommand == 113 || index == 48 || index == 49)
+	{
+		++queueSetupCommands;
+	}
+	if ((index == 48 || index == 49) && block_size != SD_EXTR_BSIZE)
+	{
+		ProtocolError("extension register access with the wrong block size");
+	}
+	if (dataCommand == 113 && !(cmd & SDMMC_CMD_SINGLE_BLOCK))
+	{
+		ProtocolError("ACMD13 is not a single block command");
+	}
+	return true;
+}
+
+bool hsmci_start_read_blocks(void *dest, uint16_t nb_block) noexcept
+{
+	uint8_t * const p = (uint8_t *)dest;
+	switch (dataCommand)
+	{
+	case 151:											// ACMD51, SCR: version 2.00, 4-bit bus
+		memset(p, 0, 8);
+		p[0] = 0x02;
+		p[2] = 0x80;
+		p[3] = 0x04;
+		break;
+
+	case 113:											// ACMD13, SD Status
+		memset(p, 0, SD_STATUS_BSIZE);
+		p[21] = card.perfClass;							// bits 339:336
+		p[22] = (uint8_t)((card.cmdqSupport << 3) | 0x04);	// bits 335:331, and 330 for cache support
+		break;
+
+	case 6:												// CMD6, switch function status
+		memset(p, 0, 64);
+		p[16] = 1;
+		break;
+
+	case 48:
+		{
+			const uint32_t fno = (dataArg >> 27) & 0x0F;
+			const uint32_t page = (dataArg >> 18) & 0xFF;
+			const uint32_t offset = (dataArg >> 9) & 0x1FF;
+			if (fno == 0 && page == 0)
+			{
+				FillGeneralInfo(p);
+			}
+			else if (fno == EXTR_PERF_FNO && page == EXTR_PERF_PAGE)
+			{
+				memset(p, 0, SD_EXTR_BSIZE);
+				memcpy(p, perfRegs + offset, SD_EXTR_BSIZE - offset);
+				if (card.rejectEnable)
+				{
+					p[0] = 0;
+				}
+			}
+			else
+			{
+				ProtocolError("read from an extension register page that does not exist");
+			}
+		}
+		break;
+
+	case 17:
+	case 18:
+		if (failStartRead && dataCommand == 18)
+		{
+			failStartRead = false;
+			return false;
+		}
+		for (uint16_t i = 0; i < nb_block; ++i)
+		{
+			FillBlock(p + SD_MMC_BLOCK_SIZE * i, readPos++);
+		}
+		blocksRead += nb_block;
+		break;
+
+	default:
+		printf("  data for command %u\n", dataCommand);
+		ProtocolError("unexpected data read");
+	}
+	return true;
+}
+
+bool hsmci_start_write_blocks(const void *src, uint16_t nb_block) noexcept
+{
+	if (dataCommand != 49)
+	{
+		ProtocolError("unexpected data write");
+		return false;
+	}
+	const uint32_t fno = (dataArg >> 27) & 0x0F;
+	const uint32_t page = (dataArg >> 18) & 0xFF;
+	const uint32_t offset = (dataArg >> 9) & 0x1FF;
+	if (fno != EXTR_PERF_FNO || page != EXTR_PERF_PAGE)
+	{
+		ProtocolError("write to an extension register page that does not exist");
+		return true;
+	}
+	perfRegs[offset] = ((const uint8_t *)src)[0];
+	if (offset == EXTR_PERF_OFFSET + SD_EXTR_PERF_CMDQ_ENABLE && (perfRegs[offset] & 1))
+	{
+		cmdqEnabled = true;
+	}
+	return true;
+}
+
+// Read some blocks and check that each one holds its own block number
+static bool CheckRead(uint32_t addr, uint16_t numBlocks)
+{
+	static uint8_t buffer[8 * SD_MMC_BLOCK_SIZE];
+	uint8_t expected[SD_MMC_BLOCK_SIZE];
+	memset(buffer, 0xEE, sizeof(buffer));
+	if (sd_mmc_mem_2_ram(0, addr, buffer, numBlocks) != CTRL_GOOD)
+	{
+		printf("  read of %u blocks at %u failed\n", (unsigned int)numBlocks, (unsigned int)addr);
+		return false;
+	}
+	for (uint16_t b = 0; b < numBlocks; ++b)
+	{
+		FillBlock(expected, addr + b);
+		if (memcmp(expected, buffer + SD_MMC_BLOCK_SIZE * b, SD_MMC_BLOCK_SIZE) != 0)
+		{
+			printf("  wrong data in block %u of the read at %u\n", (unsigned int)b, (unsigned int)addr);
+			return false;
+		}
+	}
+	return true;
+}
+
+// Initialise the card, check that command queueing was set up as expected, then read with it enabled
+static bool RunCase(const char *name, const struct CardConfig *config, unsigned int expectedDepth)
+{
+	card = *config;
+	cmdqEnabled = false;
+	memset(perfRegs, 0, sizeof(perfRegs));
+	memset(commandCount, 0, sizeof(commandCount));
+	queueSetupCommands = 0;
+	protocolErrors = 0;
+
+	sd_mmc_unmount(0);
+	const Pin wpPins[1] = { NoPin };
+	sd_mmc_init(wpPins, NULL);
+	if (sd_mmc_get_queue_depth(0) != 0)
+	{
+		printf("%s: queue depth reported before initialisation\n", name);
+		return false;
+	}
+	const sd_mmc_err_t err = sd_mmc_check(0);
+	if (err != SD_MMC_INIT_ONGOING)
+	{
+		printf("%s: initialisation failed, code %d\n", name, (int)err);
+		return false;
+	}
+	const unsigned long setupCommands = queueSetupCommands;
+	const unsigned int depth = sd_mmc_get_queue_depth(0);
+	bool ok = true;
+	if ((setupCommands != 0) != config->highCapacity)
+	{
+		printf("  the SD Status was %sread during initialisation\n", (setupCommands != 0) ? "" : "not ");
+		ok = false;
+	}
+	if (cmdqEnabled != (expectedDepth != 0 || config->rejectEnable))
+	{
+		printf("  command queueing was %senabled on the card\n", (cmdqEnabled) ? "" : "not ");
+		ok = false;
+	}
+
+	memset(commandCount, 0, sizeof(commandCount));
+	blocksRead = 0;
+	ok = CheckRead(1234, 1) && ok;
+	ok = CheckRead(100, 8) && ok;
+	ok = CheckRead(5000, 3) && ok;
+	if (queueSetupCommands != setupCommands)
+	{
+		printf("  command queueing was set up again after initialisation\n");
+		ok = false;
+	}
+
+	printf("%s: depth %u (expected %u), setup commands %lu, CMD17 %lu, CMD18 %lu, blocks %lu\n",
+			name, depth, expectedDepth, setupCommands, commandCount[17], commandCount[18], blocksRead);
+	return ok && protocolErrors == 0 && depth == expectedDepth && commandCount[17] == 1 && commandCount[18] == 2 && blocksRead == 12
+		&& !multiBlockReadOpen && !cardSelected;
+}
+
+// Make a multiple block read fail, check that it was stopped and the card deselected, then check that the next read works
+static bool RunReadError(const char *name, bool *failFlag)
+{
+	static uint8_t buffer[8 * SD_MMC_BLOCK_SIZE];
+	protocolErrors = 0;
+	memset(commandCount, 0, sizeof(commandCount));
+	*failFlag = true;
+	const Ctrl_status status = sd_mmc_mem_2_ram(0, 300, buffer, 8);
+	const unsigned long stops = commandCount[12];
+	const bool leftOpen = multiBlockReadOpen;
+	const bool leftSelected = cardSelected;
+	const bool readAfter = CheckRead(400, 4);
+	printf("%s: status %d, CMD12 %lu, %s, %s\n", name, (int)status, stops,
+			(leftOpen) ? "CMD18 LEFT OPEN" : "stopped", (leftSelected) ? "CARD LEFT SELECTED" : "deselected");
+	return status == CTRL_FAIL && stops == 1 && !leftOpen && !leftSelected && readAfter && protocolErrors == 0;
+}
+
+int main(void)
+{
+	static const struct
+	{
+		const char *name;
+		struct CardConfig config;
+		unsigned int expectedDepth;
+	} cases[] =
+	{
+		{ "A2 card, depth capped at 8",	{ true, 2, 31, false },	8 },
+		{ "A2 card, depth 2",			{ true, 2, 1, false },	2 },
+		{ "A1 card",					{ true, 1, 7, false },	0 },
+		{ "A2 card without queueing",	{ true, 2, 0, false },	0 },
+		{ "A2 card rejecting enable",	{ true, 2, 7, true },	0 },
+		{ "SDSC card",					{ false, 2, 7, false },	0 },
+	};
+
+	unsigned int failures = 0;
+	for (size_t i = 0; i < sizeof(cases)/sizeof(cases[0]); ++i)
+	{
+		if (!RunCase(cases[i].name, &cases[i].config, cases[i].expectedDepth))
+		{
+			printf("FAILED: %s\n", cases[i].name);
+			++failures;
+		}
+	}
+	if (!RunReadError("Read failing to start", &failStartRead))
+	{
+		printf("FAILED: read failing to start\n");
+		++failures;
+	}
+	if (!RunReadError("Read failing to end", &failWaitRead))
+	{
+		printf("FAILED: read failing to end\n");
+		++failures;
+	}
+	printf((failures == 0) ? "All passed\n" : "%u failed\n", failures);
+	return (failures == 0) ? 0 : 1;
+}
+
+// End
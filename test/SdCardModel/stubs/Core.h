@@ -0,0 +1,32 @@
+/*
+ * Core.h
+ *
+ * The parts of CoreNG's Core.h that the sd_mmc driver uses, for building it on the host against the SD card model.
+ */
+
+#ifndef TEST_SDCARDMODEL_STUBS_CORE_H_
+#define TEST_SDCARDMODEL_STUBS_CORE_H_
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef __cplusplus
+# define noexcept
+#endif
+
+typedef uint8_t Pin;
+static const Pin NoPin = 0xFF;
+
+typedef enum { INPUT, INPUT_PULLUP } PinMode;
+
+static inline bool digitalRead(Pin pin) { (void)pin; return false; }
+static inline void pinMode(Pin pin, PinMode mode) { (void)pin; (void)mode; }
+
+#define Assert(expr)	assert(expr)
+
+typedef uint32_t sdmmc_cmd_def_t;
+
+#endif /* TEST_SDCARDMODEL_STUBS_CORE_H_ */
@@ -0,0 +1,31 @@
+/*
+ * hsmci.h
+ *
+ * The HSMCI driver interface from CoreNG. The SD card model in SdCmdQueueTest.c implements it.
+ */
+
+#ifndef TEST_SDCARDMODEL_STUBS_HSMCI_HSMCI_H_
+#define TEST_SDCARDMODEL_STUBS_HSMCI_HSMCI_H_
+
+typedef void (*driverIdleFunc_t)(uint32_t, uint32_t);
+
+void hsmci_init(void) noexcept;
+void hsmci_select_device(uint8_t slot, uint32_t clock, uint8_t bus_width, bool high_speed) noexcept;
+void hsmci_deselect_device(uint8_t slot) noexcept;
+uint8_t hsmci_get_bus_width(uint8_t slot) noexcept;
+bool hsmci_is_high_speed_capable(void) noexcept;
+void hsmci_send_clock(void) noexcept;
+bool hsmci_send_cmd(sdmmc_cmd_def_t cmd, uint32_t arg) noexcept;
+uint32_t hsmci_get_response(void) noexcept;
+void hsmci_get_response_128(uint8_t* response) noexcept;
+bool hsmci_adtc_start(sdmmc_cmd_def_t cmd, uint32_t arg, uint16_t block_size, uint16_t nb_block, bool access_block) noexcept;
+bool hsmci_read_word(uint32_t* value) noexcept;
+bool hsmci_write_word(uint32_t value) noexcept;
+bool hsmci_start_read_blocks(void *dest, uint16_t nb_block) noexcept;
+bool hsmci_wait_end_of_read_blocks(void) noexcept;
+bool hsmci_start_write_blocks(const void *src, uint16_t nb_block) noexcept;
+bool hsmci_wait_end_of_write_blocks(void) noexcept;
+uint32_t hsmci_get_speed(void) noexcept;
+driverIdleFunc_t hsmci_set_idle_func(driverIdleFunc_t) noexcept;
+
+#endif /* TEST_SDCARDMODEL_STUBS_HSMCI_HSMCI_H_ */
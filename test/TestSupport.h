@@ -0,0 +1,115 @@
+/*
+ * TestSupport.h
+ *
+ * Shared by the host tests, the IAP harness and the kernel benchmark: the CHECK macro and builders for sample
+ * .uf2 and ELF firmware files.
+ */
+
+#ifndef TEST_TESTSUPPORT_H_
+#define TEST_TESTSUPPORT_H_
+
+#include "ElfSegments.h"
+#include "IapKernels.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// Report a failed check and carry on. The test defines "unsigned int failures" and returns 1 if it is not zero at the end.
+#define CHECK(cond)	do { if (!(cond)) { printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); ++failures; } } while (false)
+
+// The .uf2 files made by the Duet build flag that the last header word is the family ID, and give this one
+const uint32_t Uf2FlagFamilyIdPresent = 0x00002000;
+const uint32_t Uf2DuetFamilyId = 0x4855EE16;
+
+// Build a .uf2 block carrying up to 256 bytes of PAYLOAD for TARGETADDR. A shorter payload is padded with 0xFF.
+inline UF2_Block MakeUf2Block(uint32_t targetAddr, uint32_t blockNo, uint32_t numBlocks, const uint8_t *payload, size_t length)
+{
+	UF2_Block block;
+	memset(&block, 0, sizeof(block));
+	block.magicStart0 = UF2_Block::MagicStart0Val;
+	block.magicStart1 = UF2_Block::MagicStart1Val;
+	block.magicEnd = UF2_Block::MagicEndVal;
+	block.flags = Uf2FlagFamilyIdPresent;
+	block.targetAddr = targetAddr;
+	block.payloadSize = UF2_Block::DuetPayloadSize;
+	block.blockNo = blockNo;
+	block.numBlocks = numBlocks;
+	block.fileSize = Uf2DuetFamilyId;
+	memset(block.data, 0xFF, UF2_Block::DuetPayloadSize);
+	memcpy(block.data, payload, (length < UF2_Block::DuetPayloadSize) ? length : UF2_Block::DuetPayloadSize);
+	return block;
+}
+
+// Build a .uf2 file that writes FIRMWARE to flash from FLASHSTART
+inline std::vector<uint8_t> MakeUf2File(const std::vector<uint8_t>& firmware, uint32_t flashStart)
+{
+	const size_t numBlocks = (firmware.size() + UF2_Block::DuetPayloadSize - 1) / UF2_Block::DuetPayloadSize;
+	std::vector<uint8_t> file(numBlocks * sizeof(UF2_Block));
+	for (size_t i = 0; i < numBlocks; ++i)
+	{
+		const size_t offset = i * UF2_Block::DuetPayloadSize;
+		const UF2_Block block = MakeUf2Block(flashStart + offset, i, numBlocks, firmware.data() + offset, firmware.size() - offset);
+		memcpy(file.data() + i * sizeof(UF2_Block), &block, sizeof(block));
+	}
+	return file;
+}
+
+// A program header for MakeElf
+struct TestSegment
+{
+	static constexpr uint32_t SameAsPaddr = 0xFFFFFFFF;
+
+	uint32_t type;
+	uint32_t paddr;
+	uint32_t filesz;
+	uint32_t memsz;
+	int32_t offsetAdjust = 0;				// added to the file offset of the segment data, to make it point elsewhere
+	uint32_t vaddr = SameAsPaddr;
+	const uint8_t *data = nullptr;			// the FILESZ bytes of the segment, or null to fill it with its index
+};
+
+// Build an executable ELF image with the given program headers, followed by the data of each segment
+inline std::vector<uint8_t> MakeElf(const std::vector<TestSegment>& segments, uint16_t machine = Elf32_Header::MachineArm, uint32_t entry = 0)
+{
+	Elf32_Header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.ident, "\x7F" "ELF", 4);
+	header.ident[4] = Elf32_Header::Class32;
+	header.ident[5] = Elf32_Header::DataLittleEndian;
+	header.type = 2;												// executable
+	header.machine = machine;
+	header.version = 1;
+	header.entry = entry;
+	header.phoff = sizeof(Elf32_Header);
+	header.ehsize = sizeof(Elf32_Header);
+	header.phentsize = sizeof(Elf32_ProgramHeader);
+	header.phnum = segments.size();
+
+	std::vector<uint8_t> file(sizeof(Elf32_Header) + segments.size() * sizeof(Elf32_ProgramHeader));
+	memcpy(file.data(), &header, sizeof(header));
+	for (size_t i = 0; i < segments.size(); ++i)
+	{
+		const TestSegment& seg = segments[i];
+		Elf32_ProgramHeader ph;
+		memset(&ph, 0, sizeof(ph));
+		ph.type = seg.type;
+		ph.offset = file.size() + seg.offsetAdjust;
+		ph.paddr = seg.paddr;
+		ph.vaddr = (seg.vaddr == TestSegment::SameAsPaddr) ? seg.paddr : seg.vaddr;
+		ph.filesz = seg.filesz;
+		ph.memsz = seg.memsz;
+		memcpy(file.data() + sizeof(Elf32_Header) + i * sizeof(Elf32_ProgramHeader), &ph, sizeof(ph));
+		if (seg.data != nullptr)
+		{
+			file.insert(file.end(), seg.data, seg.data + seg.filesz);
+		}
+		else
+		{
+			file.resize(file.size() + seg.filesz, (uint8_t)i);
+		}
+	}
+	return file;
+}
+
+#endif /* TEST_TESTSUPPORT_H_ */
@@ -0,0 +1,66 @@
+#!/usr/bin/env python3
+"""Instructions per byte of the IAP's inner loops, counted under QEMU.
+
+  kernel_bench.py --plugin LIBINSN [--qemu COMMAND] [--length BYTES] [--repeats FEW MANY] --run LABEL MACHINE ELF [--run ...]
+
+Each --run names a build of test/KernelBench for a Cortex-M board and the QEMU machine that emulates it, such as
+mps2-an386 for the Cortex-M4. "make -C test qemu-bench" builds them and calls this script. Every kernel is run twice
+with the same inputs, FEW and MANY times over them, with QEMU's libinsn.so plugin counting the instructions executed.
+The difference between the two counts leaves out the startup code and setting up the inputs, so dividing it by the
+extra bytes processed gives the instructions per byte of the kernel alone. The table is printed as Markdown.
+
+QEMU counts instructions, not cycles. It models neither flash wait states nor the caches of the Cortex-M7, so these
+figures compare code generation and algorithms, not the time an update takes on a board.
+"""
+
+import argparse
+import re
+import subprocess
+import sys
+
+KERNELS = ['crc16', 'blank', 'verify', 'uf2', 'fread']
+INSNS = re.compile(r'insns: (\d+)')
+
+
+def count_instructions(args, machine, elf, kernel, repeats):
+	"""Run one kernel under QEMU and return the number of instructions executed"""
+	semihosting = ','.join(['enable=on', 'target=native', 'arg=KernelBench', 'arg=' + kernel,
+							'arg={}'.format(args.length), 'arg={}'.format(repeats)])
+	command = [args.qemu, '-M', machine, '-display', 'none', '-monitor', 'none', '-serial', 'none',
+			   '-semihosting-config', semihosting, '-plugin', args.plugin, '-d', 'plugin', '-kernel', elf]
+	result = subprocess.run(command, capture_output=True, text=True)
+	if result.returncode != 0:
+		sys.exit('{} {} failed:\n{}{}'.format(elf, kernel, result.stdout, result.stderr))
+	counts = INSNS.findall(result.stdout + result.stderr)
+	if not counts:
+		sys.exit('no instruction count from QEMU; is {} its libinsn.so plugin?'.format(args.plugin))
+	return int(counts[-1])						# with more than one vCPU line, the total comes last
+
+
+def main():
+	parser = argparse.ArgumentParser(description='Count the instructions per byte of the IAP kernels under QEMU')
+	parser.add_argument('--qemu', default='qemu-system-arm', help='QEMU command (default qemu-system-arm)')
+	parser.add_argument('--plugin', required=True, help="path of QEMU's libinsn.so plugin")
+	parser.add_argument('--length', type=int, default=65536, help='bytes of input for each kernel (default 65536)')
+	parser.add_argument('--repeats', type=int, nargs=2, default=[1, 5], metavar=('FEW', 'MANY'))
+	parser.add_argument('--run', nargs=3, action='append', required=True, metavar=('LABEL', 'MACHINE', 'ELF'))
+	args = parser.parse_args()
+
+	few, many = args.repeats
+	if many <= few:
+		sys.exit('MANY must be larger than FEW')
+	results = {}
+	for label, machine, elf in args.run:
+		for kernel in KERNELS:
+			extra = count_instructions(args, machine, elf, kernel, many) - count_instructions(args, machine, elf, kernel, few)
+			results[label, kernel] = extra / ((many - few) * args.length)
+
+	labels = [label for label, _, _ in args.run]
+	print('| Kernel | ' + ' | '.join(labels) + ' |')
+	print('|--------|' + '|'.join('-' * (len(label) + 1) + ':' for label in labels) + '|')
+	for kernel in KERNELS:
+		print('| {} | '.format(kernel) + ' | '.join('{:.2f}'.format(results[label, kernel]) for label in labels) + ' |')
+
+
+if __name__ == '__main__':
+	main()
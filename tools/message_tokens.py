@@ -0,0 +1,153 @@
+#!/usr/bin/env python3
+"""Message token map for the IAP_MINIMAL build.
+
+The minimal build sends each message as "#" followed by the FNV-1a hash of its format string in hex. Numeric arguments
+follow as " " and 8 hex digits, string arguments as " |text|". This script makes the map from tokens to format strings
+by scanning the sources for MessageF() and debugPrintf() calls, and decodes messages using that map.
+
+  message_tokens.py map [--uint32 long|int] [-o MAP] SOURCE...
+  message_tokens.py decode --map MAP [--strict] [FILE...]
+
+The map must be made with the integer width of the target, because the format strings include the PRIu32 family of
+macros: uint32_t is a long on the ARM targets and an int on Linux hosts. decode replaces every token message it finds
+in its input, such as a PanelDue log or the text written to the start of the flash when an update fails, and copies
+everything else unchanged. With --strict it fails if it meets a token that is not in the map.
+"""
+
+import argparse
+import re
+import sys
+
+MESSAGE_CALL = re.compile(r'\b(?:MessageF|debugPrintf)\s*\(')
+STRING_LITERAL = re.compile(r'\s*"((?:[^"\\]|\\.)*)"')
+INT_MACRO = re.compile(r'\s*(PRI[diouxX])(8|16|32|64|PTR)\b')
+TOKEN_MESSAGE = re.compile(r'#([0-9a-f]{8})((?: (?:[0-9a-f]{8}|\|[^|]*\|))*)')
+ARGUMENT = re.compile(r' (?:([0-9a-f]{8})|\|([^|]*)\|)')
+CONVERSION = re.compile(r'%([-+ #0]*)(\d*)(?:\.(\d+))?(?:hh|h|ll|l|z|j|t)?([diouxXcs%])')
+ESCAPES = {'n': '\n', 't': '\t', '\\': '\\', '"': '"', "'": "'"}
+
+
+def fnv1a(text):
+	value = 2166136261
+	for byte in text.encode('latin-1'):
+		value = ((value ^ byte) * 16777619) & 0xFFFFFFFF
+	return value
+
+
+def unescape(literal):
+	return re.sub(r'\\(.)', lambda m: ESCAPES.get(m.group(1), m.group(1)), literal)
+
+
+def format_strings(source, uint32):
+	"""Yield the format string of every message call in the source, with the PRI macros expanded as the compiler would"""
+	lengths = {'8': '', '16': '', '32': 'l' if uint32 == 'long' else '', '64': 'll', 'PTR': ''}
+	for call in MESSAGE_CALL.finditer(source):
+		pos = call.end()
+		parts = []
+		while True:
+			literal = STRING_LITERAL.match(source, pos)
+			if literal:
+				parts.append(unescape(literal.group(1)))
+				pos = literal.end()
+				continue
+			macro = INT_MACRO.match(source, pos)
+			if macro:
+				parts.append(lengths[macro.group(2)] + macro.group(1)[3])
+				pos = macro.end()
+				continue
+			break
+		if parts:
+			yield ''.join(parts)
+
+
+def make_map(args):
+	formats = {}
+	for path in args.sources:
+		with open(path, encoding='utf-8') as f:
+			source = f.read()
+		for fmt in format_strings(source, args.uint32):
+			token = fnv1a(fmt)
+			if formats.get(token, fmt) != fmt:
+				sys.exit('{}: token {:08x} is shared by "{}" and "{}"'.format(path, token, formats[token], fmt))
+			formats[token] = fmt
+	lines = ['{:08x} {}\n'.format(token, fmt.encode('unicode_escape').decode('ascii')) for token, fmt in sorted(formats.items())]
+	if args.output:
+		with open(args.output, 'w', encoding='ascii') as f:
+			f.writelines(lines)
+	else:
+		sys.stdout.writelines(lines)
+
+
+def read_map(path):
+	formats = {}
+	with open(path, encoding='ascii') as f:
+		for line in f:
+			token, _, fmt = line.rstrip('\n').partition(' ')
+			formats[int(token, 16)] = fmt.encode('ascii').decode('unicode_escape')
+	return formats
+
+
+def format_message(fmt, args):
+	"""Apply a printf format to the decoded arguments, which are ints for numeric conversions and strs for %s"""
+	args = iter(args)
+
+	def convert(m):
+		flags, width, precision, conversion = m.groups()
+		if conversion == '%':
+			return '%'
+		value = next(args, None)
+		if value is None:
+			return '<missing>'
+		if conversion == 's':
+			return ('%' + flags + width + 's') % (value if isinstance(value, str) else '<0x{:08x}>'.format(value))
+		if isinstance(value, str):
+			return value
+		if conversion in 'di' and value >= 0x80000000:
+			value -= 0x100000000
+		python_conversion = {'i': 'd', 'u': 'd'}.get(conversion, conversion)
+		spec = '%' + flags + width + ('.' + precision if precision else '') + python_conversion
+		return spec % (chr(value & 0xFF) if conversion == 'c' else value)
+
+	return CONVERSION.sub(convert, fmt)
+
+
+def decode(args):
+	formats = read_map(args.map)
+	unknown = []
+
+	def replace(m):
+		token = int(m.group(1), 16)
+		if token not in formats:
+			unknown.append(m.group(0))
+			return m.group(0)
+		values = [int(a.group(1), 16) if a.group(1) is not None else a.group(2) for a in ARGUMENT.finditer(m.group(2))]
+		return format_message(formats[token], values)
+
+	files = [open(path, encoding='latin-1') for path in args.files] if args.files else [sys.stdin]
+	for f in files:
+		for line in f:
+			sys.stdout.write(TOKEN_MESSAGE.sub(replace, line))
+	if unknown and args.strict:
+		sys.exit('unknown message tokens: ' + ', '.join(unknown))
+
+
+def main():
+	parser = argparse.ArgumentParser(description='Make or use the message token map of the IAP_MINIMAL build')
+	commands = parser.add_subparsers(dest='command', required=True)
+	map_parser = commands.add_parser('map', help='make the token map from the sources')
+	map_parser.add_argument('--uint32', choices=('long', 'int'), default='long', help='type of uint32_t on the target (default long, as on ARM)')
+	map_parser.add_argument('-o', '--output', help='file to write the map to (default standard output)')
+	map_parser.add_argument('sources', nargs='+')
+	decode_parser = commands.add_parser('decode', help='decode token messages')
+	decode_parser.add_argument('--map', required=True)
+	decode_parser.add_argument('--strict', action='store_true', help='fail if a token is not in the map')
+	decode_parser.add_argument('files', nargs='*')
+	args = parser.parse_args()
+	if args.command == 'map':
+		make_map(args)
+	else:
+		decode(args)
+
+
+if __name__ == '__main__':
+	main()
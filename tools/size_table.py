@@ -0,0 +1,60 @@
+#!/usr/bin/env python3
+"""Size table of the full and IAP_MINIMAL builds.
+
+  size_table.py [--size COMMAND] [--project DIR]
+  size_table.py [--size COMMAND] --row LABEL FULL MINIMAL [--row ...]
+
+Without --row it compares the binaries that the Eclipse configurations leave in DIR (default: the project directory),
+SAM4E_Release against SAM4E_Minimal and SAM4E_RAM against SAM4E_RAM_Minimal, using arm-none-eabi-size. Each --row
+compares two lists of object or ELF files separated by commas, whose sizes are added up. "make -C test sizes" uses
+--row with host objects, which are only a proxy for the ARM sizes. The table is printed as Markdown, in the form used
+in README.md.
+"""
+
+import argparse
+import os
+import subprocess
+import sys
+
+CONFIGURATIONS = [
+	('SAM4E, flash (iap4e)', 'SAM4E_Release/iap4e.elf', 'SAM4E_Minimal/iap4e.elf'),
+	('SAM4E, IAP_IN_RAM (Duet2CombinedIAP)', 'SAM4E_RAM/Duet2CombinedIAP.elf', 'SAM4E_RAM_Minimal/Duet2CombinedIAP.elf'),
+]
+
+
+def sizes(size_command, files):
+	"""Return the total text, data and bss sizes of the files, as reported by the Berkeley format of size"""
+	output = subprocess.run([size_command, '-B'] + files, check=True, capture_output=True, text=True).stdout
+	total = [0, 0, 0]
+	for line in output.splitlines()[1:]:
+		fields = line.split()
+		for i in range(3):
+			total[i] += int(fields[i])
+	return total
+
+
+def main():
+	parser = argparse.ArgumentParser(description='Compare the sizes of the full and IAP_MINIMAL builds')
+	parser.add_argument('--size', default='arm-none-eabi-size', help='size command (default arm-none-eabi-size)')
+	parser.add_argument('--project', default=os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'),
+						help='directory holding the Eclipse build output folders')
+	parser.add_argument('--row', nargs=3, action='append', metavar=('LABEL', 'FULL', 'MINIMAL'))
+	args = parser.parse_args()
+
+	rows = args.row or [(label, os.path.join(args.project, full), os.path.join(args.project, minimal)) for label, full, minimal in CONFIGURATIONS]
+	print('| Build | Full text+data | Minimal text+data | Saved | Full bss | Minimal bss |')
+	print('|-------|---------------:|------------------:|------:|---------:|------------:|')
+	for label, full, minimal in rows:
+		missing = [f for f in (full + ',' + minimal).split(',') if not os.path.exists(f)]
+		if missing:
+			sys.exit('not built: ' + ', '.join(missing))
+		full_text, full_data, full_bss = sizes(args.size, full.split(','))
+		minimal_text, minimal_data, minimal_bss = sizes(args.size, minimal.split(','))
+		full_flash = full_text + full_data
+		minimal_flash = minimal_text + minimal_data
+		print('| {} | {} | {} | {} ({:.0%}) | {} | {} |'.format(label, full_flash, minimal_flash, full_flash - minimal_flash,
+															   (full_flash - minimal_flash) / full_flash, full_bss, minimal_bss))
+
+
+if __name__ == '__main__':
+	main()